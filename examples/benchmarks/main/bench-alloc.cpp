@@ -0,0 +1,119 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Zauberzeug GmbH
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "esp_zeug/alloc.h"
+#include "esp_zeug/eventhandler.h"
+#include "esp_zeug/frtos-util.h"
+
+#include "bench.h"
+
+using namespace ZZ;
+
+namespace {
+std::atomic<std::uint32_t> s_heapCalls{0};
+} // namespace
+
+/* Counts every C++ heap allocation of the whole application */
+auto operator new(std::size_t size) -> void * {
+    ++s_heapCalls;
+
+    void *ptr{std::malloc(size != 0 ? size : 1)};
+
+    /* Built without exceptions, like the IDF default */
+    if (ptr == nullptr) {
+        std::abort();
+    }
+
+    return ptr;
+}
+
+auto operator delete(void *ptr) noexcept -> void {
+    std::free(ptr);
+}
+
+auto operator delete(void *ptr, std::size_t) noexcept -> void {
+    std::free(ptr);
+}
+
+namespace {
+
+constexpr std::size_t ROUNDS{200};
+/* Both variants reserve like a careful handler would, otherwise every growth
+ * step leaves the previous buffer behind in the arena */
+constexpr std::size_t RESPONSE_RESERVE{2048};
+
+/* What a typical stats endpoint does: build a JSON document and send it. The
+ * document is built into whatever string type the handler hands in. */
+template <typename String>
+auto handleRequest(String &out) -> std::size_t {
+    out.reserve(RESPONSE_RESERVE);
+    out.append("{\"tasks\":");
+    FrtosUtil::TaskTelemetry::reportJson(out);
+    out.append(",\"events\":");
+    EventStats::reportJson(out);
+    out.append("}");
+
+    return out.size();
+}
+
+template <typename Fn>
+auto measure(const char *name, const Fn &fn) -> void {
+    const std::uint32_t callsBefore{s_heapCalls.load()};
+    const double us{Bench::timeUs(ROUNDS, fn)};
+    /* timeUs() does one warm-up call on top */
+    const double callsPerRequest{static_cast<double>(s_heapCalls.load() - callsBefore) / (ROUNDS + 1)};
+
+    std::printf("%-28s %6.1f heap calls/request  %7.1f us/request\n", name, callsPerRequest, us);
+}
+
+} // namespace
+
+auto Bench::alloc() -> void {
+    heading("Heap calls per HTTP request, std::string vs. request arena");
+
+    static std::array<FrtosUtil::TaskTelemetry, 4> telemetry;
+    static EventStats wifiStats{"WIFI_EVENT"};
+    static EventStats ipStats{"IP_EVENT"};
+    static Alloc::Arena<4096> arena;
+
+    for (FrtosUtil::TaskTelemetry &entry : telemetry) {
+        entry.attach("bench", 4096, xTaskGetCurrentTaskHandle(), xPortGetCoreID());
+    }
+
+    std::size_t length{0};
+
+    measure("std::string", [&length]() {
+        std::string out;
+        length = handleRequest(out);
+    });
+
+    /* What EndpointHandler::invoke() does for an endpoint with setArena() */
+    measure("ArenaString, ArenaScope", [&length]() {
+        Alloc::ArenaScope scope{arena};
+        Alloc::ArenaString out{Alloc::ArenaAllocator<char>{arena}};
+        length = handleRequest(out);
+    });
+
+    std::printf("response %u B, arena high water %u of %u B, %u failed arena allocations\n",
+                unsigned(length), unsigned(arena.usage().highWater), unsigned(arena.usage().capacity),
+                unsigned(arena.usage().failures));
+
+    for (FrtosUtil::TaskTelemetry &entry : telemetry) {
+        entry.detach();
+    }
+}
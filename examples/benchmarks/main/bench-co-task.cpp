@@ -0,0 +1,143 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Zauberzeug GmbH
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "esp_zeug/co-task.h"
+
+#include "bench.h"
+
+using namespace ZZ;
+
+namespace {
+
+constexpr std::uint32_t ROUNDS{10000};
+constexpr std::size_t STACK_SIZE{2048};
+
+/* Two native tasks on the same core handing a task notification back and forth,
+ * every hand-over is a context switch */
+struct NativePingPong {
+    TaskHandle_t *peer;
+    TaskHandle_t main;
+    bool initiator;
+    std::int64_t startUs;
+    std::int64_t endUs;
+};
+
+auto nativeLoop(void *arg) -> void {
+    auto &self{*static_cast<NativePingPong *>(arg)};
+    self.startUs = esp_timer_get_time();
+
+    for (std::uint32_t round = 0; round < ROUNDS; ++round) {
+        if (self.initiator) {
+            xTaskNotifyGive(*self.peer);
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        } else {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            xTaskNotifyGive(*self.peer);
+        }
+    }
+
+    self.endUs = esp_timer_get_time();
+
+    if (self.initiator) {
+        xTaskNotifyGive(self.main);
+    }
+
+    vTaskDelete(nullptr);
+}
+
+/* The same exchange between two CoTasks, which only ever switch within the executor */
+struct CoPingPong : FrtosUtil::CoTask {
+    FrtosUtil::CoEvent m_event;
+    CoPingPong *m_peer{nullptr};
+    bool m_initiator{false};
+    std::uint32_t m_round{0};
+    std::int64_t m_startUs{0};
+    std::int64_t m_endUs{0};
+    std::atomic<bool> m_done{false};
+
+    auto resume() -> FrtosUtil::CoStatus override {
+        ZZ_CO_BEGIN;
+        m_startUs = esp_timer_get_time();
+
+        for (m_round = 0; m_round < ROUNDS; ++m_round) {
+            if (m_initiator) {
+                m_peer->m_event.signal();
+                ZZ_CO_AWAIT(FrtosUtil::Co::event(m_event));
+            } else {
+                ZZ_CO_AWAIT(FrtosUtil::Co::event(m_event));
+                m_peer->m_event.signal();
+            }
+        }
+
+        m_endUs = esp_timer_get_time();
+        m_done = true;
+        ZZ_CO_END;
+    }
+};
+
+auto native() -> void {
+    TaskHandle_t ping{nullptr};
+    TaskHandle_t pong{nullptr};
+    NativePingPong pingState{&pong, xTaskGetCurrentTaskHandle(), true, 0, 0};
+    NativePingPong pongState{&ping, nullptr, false, 0, 0};
+    const BaseType_t core{xPortGetCoreID()};
+    const UBaseType_t priority{uxTaskPriorityGet(nullptr) + 1};
+
+    const std::size_t heapBefore{esp_get_free_heap_size()};
+    xTaskCreatePinnedToCore(nativeLoop, "bench-pong", STACK_SIZE, &pongState, priority, &pong, core);
+    const std::size_t heapPerTask{heapBefore - esp_get_free_heap_size()};
+    xTaskCreatePinnedToCore(nativeLoop, "bench-ping", STACK_SIZE, &pingState, priority, &ping, core);
+
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    const double hopUs{static_cast<double>(pingState.endUs - pingState.startUs) / (2 * ROUNDS)};
+    std::printf("native Tasks: %6.2f us per hand-over, %u B heap per task (%u B stack), "
+                "FrtosUtil::Task<%u> %u B static\n",
+                hopUs, unsigned(heapPerTask), unsigned(STACK_SIZE), unsigned(STACK_SIZE),
+                unsigned(sizeof(FrtosUtil::Task<STACK_SIZE>)));
+}
+
+auto coTasks() -> void {
+    static FrtosUtil::CoExecutor<> executor{"bench-co", static_cast<FrtosUtil::Core::Id>(xPortGetCoreID())};
+    static CoPingPong ping;
+    static CoPingPong pong;
+
+    ping.m_peer = &pong;
+    ping.m_initiator = true;
+    pong.m_peer = &ping;
+
+    executor.run();
+    executor.spawn(pong);
+    executor.spawn(ping);
+
+    while (!ping.m_done) {
+        vTaskDelay(1);
+    }
+
+    const double hopUs{static_cast<double>(ping.m_endUs - ping.m_startUs) / (2 * ROUNDS)};
+    std::printf("CoTasks:      %6.2f us per hand-over, %u B per CoTask, CoExecutor<> %u B shared by all\n",
+                hopUs, unsigned(sizeof(CoPingPong)), unsigned(sizeof(FrtosUtil::CoExecutor<>)));
+}
+
+} // namespace
+
+auto Bench::coTask() -> void {
+    heading("CoTask vs. native Task ping-pong");
+
+    native();
+    coTasks();
+}
@@ -0,0 +1,138 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Zauberzeug GmbH
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+
+#include <esp_random.h>
+#include <mbedtls/base64.h>
+
+#include "esp_zeug/codec.h"
+#include "esp_zeug/util.h"
+
+#include "bench.h"
+
+using namespace ZZ;
+
+namespace {
+
+constexpr std::size_t BYTES{1024};
+constexpr std::size_t ROUNDS{200};
+constexpr std::size_t CROSS_CHECKS{500};
+
+std::array<std::byte, BYTES> s_data{};
+/* Hex is the longer encoding, plus the terminator snprintf and mbedTLS write */
+std::array<char, Codec::hexEncodedSize(BYTES) + 1> s_text{};
+std::array<char, Codec::hexEncodedSize(BYTES) + 1> s_referenceText{};
+std::array<std::byte, BYTES> s_decoded{};
+std::array<std::byte, BYTES> s_referenceDecoded{};
+
+/* What the code base did before Codec: one snprintf per byte */
+auto hexEncodePerChar(const std::byte *src, std::size_t len, char *dst) -> void {
+    for (std::size_t idx = 0; idx < len; ++idx) {
+        std::snprintf(dst + idx * 2, 3, "%02x", unsigned(src[idx]));
+    }
+}
+
+/* ... and one Util::charPairToByte() per pair, after checking both with isHex() */
+auto hexDecodePerChar(const char *src, std::size_t len, std::byte *dst) -> bool {
+    for (std::size_t idx = 0; idx + 1 < len; idx += 2) {
+        if (!Util::isHex(src[idx]) || !Util::isHex(src[idx + 1])) {
+            return false;
+        }
+        dst[idx / 2] = static_cast<std::byte>(Util::charPairToByte(src[idx], src[idx + 1]));
+    }
+
+    return true;
+}
+
+/* Random lengths and contents, every result compared against the per-char
+ * helpers and mbedTLS, and decoded back to the input */
+auto crossCheck() -> bool {
+    for (std::size_t round = 0; round < CROSS_CHECKS; ++round) {
+        const std::size_t len{esp_random() % 64};
+        const Util::ByteBufferView src{s_data.data(), len};
+        esp_fill_random(s_data.data(), len);
+
+        const std::size_t hexLen{Codec::hexEncode(src, s_text.data(), s_text.size())};
+        hexEncodePerChar(s_data.data(), len, s_referenceText.data());
+
+        if (hexLen != Codec::hexEncodedSize(len) || std::memcmp(s_text.data(), s_referenceText.data(), hexLen) != 0 ||
+            Codec::hexDecode({s_text.data(), hexLen}, s_decoded.data(), s_decoded.size()) != len ||
+            std::memcmp(s_decoded.data(), s_data.data(), len) != 0) {
+            std::printf("hex mismatch at %u bytes\n", unsigned(len));
+            return false;
+        }
+
+        const std::size_t b64Len{Codec::base64Encode(src, s_text.data(), s_text.size())};
+        std::size_t referenceLen{0};
+        mbedtls_base64_encode(reinterpret_cast<unsigned char *>(s_referenceText.data()), s_referenceText.size(), &referenceLen,
+                              reinterpret_cast<const unsigned char *>(s_data.data()), len);
+
+        if (b64Len != referenceLen || std::memcmp(s_text.data(), s_referenceText.data(), b64Len) != 0 ||
+            Codec::base64Decode({s_text.data(), b64Len}, s_decoded.data(), s_decoded.size()) != len ||
+            std::memcmp(s_decoded.data(), s_data.data(), len) != 0) {
+            std::printf("base64 mismatch at %u bytes\n", unsigned(len));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+auto report(const char *name, double codecUs, double referenceUs) -> void {
+    std::printf("%-16s Codec %7.1f us  reference %7.1f us  speedup %.1f\n",
+                name, codecUs, referenceUs, referenceUs / codecUs);
+}
+
+} // namespace
+
+auto Bench::codec() -> void {
+    heading("Codec vs. per-char helpers and mbedTLS, 1 KiB");
+
+    std::printf("cross-check (%u random buffers): %s\n", unsigned(CROSS_CHECKS), crossCheck() ? "ok" : "FAILED");
+
+    esp_fill_random(s_data.data(), s_data.size());
+    const Util::ByteBufferView src{s_data.data(), s_data.size()};
+    const std::string_view hex{s_text.data(), Codec::hexEncodedSize(BYTES)};
+    const std::string_view base64{s_text.data(), Codec::base64EncodedSize(BYTES)};
+    std::size_t len{0};
+
+    report("hex encode",
+           timeUs(ROUNDS, [&]() { Codec::hexEncode(src, s_text.data(), s_text.size()); }),
+           timeUs(ROUNDS, [&]() { hexEncodePerChar(s_data.data(), BYTES, s_referenceText.data()); }));
+
+    Codec::hexEncode(src, s_text.data(), s_text.size());
+    report("hex decode",
+           timeUs(ROUNDS, [&]() { Codec::hexDecode(hex, s_decoded.data(), s_decoded.size()); }),
+           timeUs(ROUNDS, [&]() { hexDecodePerChar(hex.data(), hex.size(), s_referenceDecoded.data()); }));
+
+    report("base64 encode",
+           timeUs(ROUNDS, [&]() { Codec::base64Encode(src, s_text.data(), s_text.size()); }),
+           timeUs(ROUNDS, [&]() {
+               mbedtls_base64_encode(reinterpret_cast<unsigned char *>(s_referenceText.data()), s_referenceText.size(), &len,
+                                     reinterpret_cast<const unsigned char *>(s_data.data()), BYTES);
+           }));
+
+    Codec::base64Encode(src, s_text.data(), s_text.size());
+    report("base64 decode",
+           timeUs(ROUNDS, [&]() { Codec::base64Decode(base64, s_decoded.data(), s_decoded.size()); }),
+           timeUs(ROUNDS, [&]() {
+               mbedtls_base64_decode(reinterpret_cast<unsigned char *>(s_referenceDecoded.data()), s_referenceDecoded.size(), &len,
+                                     reinterpret_cast<const unsigned char *>(base64.data()), base64.size());
+           }));
+
+    /* The timed loops write their results, make sure they weren't optimized away */
+    std::printf("decoded buffers match: %s\n",
+                std::memcmp(s_decoded.data(), s_data.data(), BYTES) == 0 &&
+                        std::memcmp(s_referenceDecoded.data(), s_data.data(), BYTES) == 0
+                    ? "yes"
+                    : "NO");
+}
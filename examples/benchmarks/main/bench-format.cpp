@@ -0,0 +1,81 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Zauberzeug GmbH
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "esp_zeug/util.h"
+
+#include "bench.h"
+
+using namespace ZZ;
+
+namespace {
+
+constexpr std::size_t ROUNDS{2000};
+
+/* Keeps the compiler from dropping results nobody reads */
+volatile std::size_t s_sink{0};
+
+/* Both variants get the same arguments and have to produce the same text for
+ * every value the timing went through */
+template <typename FormatFn, typename PrintfFn>
+auto compare(const char *name, const FormatFn &formatFn, const PrintfFn &printfFn) -> void {
+    Util::TextBuffer<96> formatted;
+    Util::TextBuffer<96> printed;
+    std::uint32_t value{0};
+
+    const double formatUs{Bench::timeUs(ROUNDS, [&]() {
+        formatFn(formatted, ++value);
+        s_sink = s_sink + formatted.length();
+    })};
+    const double printfUs{Bench::timeUs(ROUNDS, [&]() {
+        printfFn(printed, ++value);
+        s_sink = s_sink + printed.length();
+    })};
+
+    bool same{true};
+    for (std::uint32_t checked = 0; checked <= value && same; ++checked) {
+        formatFn(formatted, checked);
+        printfFn(printed, checked);
+        same = formatted.length() == printed.length() &&
+               std::memcmp(formatted.data(), printed.data(), printed.length()) == 0;
+    }
+
+    std::printf("%-18s format %6.2f us  vsnprintf %6.2f us  speedup %.2f%s\n",
+                name, formatUs, printfUs, printfUs / formatUs, same ? "" : "  OUTPUT DIFFERS");
+    if (!same) {
+        std::printf("  format:    \"%s\"\n  vsnprintf: \"%s\"\n", formatted.data(), printed.data());
+    }
+}
+
+} // namespace
+
+auto Bench::format() -> void {
+    heading("TextBuffer::format() vs. vsnprintf");
+
+    compare(
+        "integers",
+        [](auto &buf, std::uint32_t value) { buf.format(ZZ_FMT("id={} delta={} total={}"), value, -int(value % 1000), value * 7u); },
+        [](auto &buf, std::uint32_t value) { buf.printf("id=%u delta=%d total=%u", unsigned(value), -int(value % 1000), unsigned(value * 7u)); });
+
+    compare(
+        "padded hex",
+        [](auto &buf, std::uint32_t value) { buf.format(ZZ_FMT("addr=0x{:08x} flags={:04X}"), value * 2654435761u, value & 0xFFFF); },
+        [](auto &buf, std::uint32_t value) { buf.printf("addr=0x%08x flags=%04X", unsigned(value * 2654435761u), unsigned(value & 0xFFFF)); });
+
+    compare(
+        "float",
+        [](auto &buf, std::uint32_t value) { buf.format(ZZ_FMT("temp={:.2} load={:6.1}"), value * 0.01, value % 100 * 1.5f); },
+        [](auto &buf, std::uint32_t value) { buf.printf("temp=%.2f load=%6.1f", value * 0.01, double(value % 100 * 1.5f)); });
+
+    compare(
+        "string",
+        [](auto &buf, std::uint32_t value) { buf.format(ZZ_FMT("[{}] {:12} #{}"), "esp_zeug", "endpoint", value); },
+        [](auto &buf, std::uint32_t value) { buf.printf("[%s] %12s #%u", "esp_zeug", "endpoint", unsigned(value)); });
+}
@@ -0,0 +1,66 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Zauberzeug GmbH
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <array>
+#include <cstddef>
+#include <cstdio>
+
+#include "esp_zeug/worker-pool.h"
+
+#include "bench.h"
+
+using namespace ZZ;
+
+namespace {
+
+constexpr std::size_t ELEMENTS{16 * 1024};
+constexpr std::size_t GRAIN{512};
+constexpr std::size_t ROUNDS{20};
+
+std::array<float, ELEMENTS> s_data{};
+
+/* CPU bound and independent per element, so the only limit to scaling is the pool */
+auto work(std::size_t begin, std::size_t end) -> void {
+    for (std::size_t idx = begin; idx < end; ++idx) {
+        float value{s_data[idx]};
+
+        for (int round = 0; round < 32; ++round) {
+            value = value * 0.999f + 0.5f;
+        }
+
+        s_data[idx] = value;
+    }
+}
+
+/* Pools are never torn down, their Tasks keep running for the rest of the program */
+template <std::size_t Workers>
+auto scaling(double baselineUs) -> void {
+    static FrtosUtil::WorkerPool<Workers> pool;
+    pool.run();
+    FrtosUtil::Task<>::delayMiliSeconds(10);
+
+    const double us{Bench::timeUs(ROUNDS, []() { pool.parallelFor(0, ELEMENTS, GRAIN, work); })};
+    std::printf("%u worker(s) + caller: %8.1f us  speedup %.2f\n", unsigned(Workers), us, baselineUs / us);
+
+    for (std::size_t idx = 0; idx < Workers; ++idx) {
+        const auto stats{pool.workerStats(idx)};
+        std::printf("  worker %u: executed %u, stolen %u\n", unsigned(idx), unsigned(stats.executed), unsigned(stats.stolen));
+    }
+}
+
+} // namespace
+
+auto Bench::workerPool() -> void {
+    heading("WorkerPool parallelFor scaling");
+
+    const double baselineUs{timeUs(ROUNDS, []() { work(0, ELEMENTS); })};
+    std::printf("calling task only:    %8.1f us\n", baselineUs);
+
+    scaling<1>(baselineUs);
+    scaling<2>(baselineUs);
+    scaling<3>(baselineUs);
+    scaling<4>(baselineUs);
+}
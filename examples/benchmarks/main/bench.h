@@ -0,0 +1,43 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Zauberzeug GmbH
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ZZ_BENCH_H
+#define ZZ_BENCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#include <esp_timer.h>
+
+namespace Bench {
+
+/* Mean time of one call to fn in microseconds, after a warm-up call */
+template <typename Fn>
+auto timeUs(std::size_t iterations, const Fn &fn) -> double {
+    fn();
+
+    const std::int64_t start{esp_timer_get_time()};
+    for (std::size_t idx = 0; idx < iterations; ++idx) {
+        fn();
+    }
+
+    return static_cast<double>(esp_timer_get_time() - start) / iterations;
+}
+
+inline auto heading(const char *name) -> void {
+    std::printf("\n== %s ==\n", name);
+}
+
+auto workerPool() -> void;
+auto coTask() -> void;
+auto alloc() -> void;
+auto format() -> void;
+auto codec() -> void;
+
+} // namespace Bench
+
+#endif // ZZ_BENCH_H
@@ -0,0 +1,15 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Zauberzeug GmbH
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "bench.h"
+
+extern "C" void app_main() {
+    Bench::workerPool();
+    Bench::coTask();
+    Bench::alloc();
+    Bench::format();
+    Bench::codec();
+}
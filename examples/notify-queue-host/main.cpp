@@ -0,0 +1,418 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Zauberzeug GmbH
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "esp_zeug/ble/notify-queue.h"
+
+using namespace ZZ;
+
+namespace {
+
+struct Notification {
+    std::uint16_t connHandle;
+    std::uint16_t attrHandle;
+    std::string payload;
+};
+
+/* Stands in for NimBLE: a pool of s_buffers mbufs, refilled by transmit() as
+ * the controller would, and NOTIFY_TX raised from within notify() for every
+ * attempt, the failed ones included. s_onNotify runs before a notification is
+ * sent, s_errors makes the next sends fail for good. */
+struct FakeBackend {
+    using Lock = std::mutex;
+
+    /* Runs when the test says so, see fireTimers() */
+    class Timer {
+        void (*const m_fn)(void *);
+        void *const m_arg;
+
+    public:
+        Timer(void (*fn)(void *), void *arg)
+            : m_fn{fn}, m_arg{arg} {
+        }
+
+        ~Timer() {
+            s_armed.erase(std::remove(s_armed.begin(), s_armed.end(), this), s_armed.end());
+        }
+
+        auto start(std::uint32_t) -> void {
+            if (std::find(s_armed.begin(), s_armed.end(), this) == s_armed.end()) {
+                s_armed.push_back(this);
+            }
+        }
+
+        auto fire() -> void {
+            m_fn(m_arg);
+        }
+    };
+
+    static constexpr int ENOMEM_RC{6}; /* BLE_HS_ENOMEM */
+    static constexpr int EINVAL_RC{3}; /* BLE_HS_EINVAL */
+
+    static inline std::uint16_t s_mtu{23};
+    static inline int s_buffers{0};
+    static inline int s_errors{0};
+    static inline std::int64_t s_nowUs{0};
+    static inline std::vector<Notification> s_sent;
+    static inline std::vector<Timer *> s_armed;
+    static inline std::function<void()> s_onNotify;
+    static inline std::function<void(int)> s_onNotifyTx;
+
+    static auto mtu(std::uint16_t) -> std::uint16_t {
+        return s_mtu;
+    }
+
+    static auto notify(std::uint16_t connHandle, std::uint16_t attrHandle, const Util::ByteBufferView &payload) -> int {
+        if (s_onNotify) {
+            std::function<void()> hook{std::move(s_onNotify)};
+            s_onNotify = nullptr;
+            hook();
+        }
+
+        int rc{0};
+
+        if (s_errors > 0) {
+            --s_errors;
+            rc = EINVAL_RC;
+        } else if (s_buffers == 0) {
+            rc = ENOMEM_RC;
+        } else {
+            --s_buffers;
+            s_sent.push_back(Notification{connHandle, attrHandle, std::string{reinterpret_cast<const char *>(payload.data()), payload.size()}});
+        }
+
+        if (s_onNotifyTx) {
+            s_onNotifyTx(rc);
+        }
+
+        return rc;
+    }
+
+    static auto isBackPressure(int rc) -> bool {
+        return rc == ENOMEM_RC;
+    }
+
+    static auto nowUs() -> std::int64_t {
+        return s_nowUs += 1000;
+    }
+
+    /* The controller sent count notifications, their buffers are free again */
+    static auto transmit(int count) -> void {
+        s_buffers += count;
+    }
+
+    /* Runs the timers armed so far, returns how many */
+    static auto fireTimers() -> std::size_t {
+        const std::vector<Timer *> armed{std::move(s_armed)};
+        s_armed.clear();
+
+        for (Timer *timer : armed) {
+            timer->fire();
+        }
+
+        return armed.size();
+    }
+
+    static auto clear(int buffers) -> void {
+        s_mtu = 23;
+        s_buffers = buffers;
+        s_errors = 0;
+        s_sent.clear();
+        s_armed.clear();
+        s_onNotify = nullptr;
+        s_onNotifyTx = nullptr;
+    }
+};
+
+/* Payload limit for the default MTU of 23 */
+constexpr std::size_t LIMIT{20};
+
+using Queue = Ble::NotifyQueue<FakeBackend, 64>;
+
+int s_failed{0};
+
+#define CHECK(condition)                                                          \
+    do {                                                                          \
+        if (!(condition)) {                                                       \
+            std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++s_failed;                                                           \
+        }                                                                         \
+    } while (false)
+
+auto view(const std::string &str) -> Util::ByteBufferView {
+    return Util::ByteBufferView{reinterpret_cast<const std::byte *>(str.data()), str.size()};
+}
+
+auto sentPayload(std::size_t idx) -> std::string {
+    return idx < FakeBackend::s_sent.size() ? FakeBackend::s_sent[idx].payload : std::string{"<nothing>"};
+}
+
+auto backPressureAndCoalescing() -> void {
+    FakeBackend::clear(2);
+    Queue queue{1};
+
+    /* Two buffers, both updates go out right away */
+    CHECK(queue.enqueue(10, view("aa")));
+    CHECK(queue.enqueue(10, view("bb")));
+    CHECK(FakeBackend::s_sent.size() == 2);
+
+    CHECK(queue.enqueue(10, view("cc")));
+    CHECK(queue.enqueue(10, view("dd")));
+    CHECK(queue.enqueue(11, view("x")));
+    CHECK(queue.enqueue(10, view("ee")));
+    CHECK(FakeBackend::s_sent.size() == 2);
+    CHECK(FakeBackend::s_armed.size() == 1);
+
+    /* Consecutive updates of a characteristic leave together, others don't join */
+    FakeBackend::transmit(1);
+    CHECK(FakeBackend::fireTimers() == 1);
+    CHECK(sentPayload(2) == "ccdd" && FakeBackend::s_sent[2].attrHandle == 10);
+    CHECK(FakeBackend::s_sent.size() == 3);
+
+    FakeBackend::transmit(2);
+    CHECK(FakeBackend::fireTimers() == 1);
+    CHECK(sentPayload(3) == "x" && FakeBackend::s_sent[3].attrHandle == 11);
+    CHECK(sentPayload(4) == "ee");
+    CHECK(queue.pending() == 0);
+    CHECK(FakeBackend::s_armed.empty());
+
+    const Queue::Stats stats{queue.stats()};
+    CHECK(stats.updates == 6 && stats.coalesced == 1 && stats.notifications == 5 && stats.bytesSent == 11);
+    CHECK(stats.stalls == 5 && stats.sendErrors == 0);
+}
+
+/* NimBLE raises NOTIFY_TX before ble_gatts_notify_custom() returns, for failed
+ * sends as well. Neither may refill anything nor recurse into sending, and an
+ * update queued from the event has to go out with the current pump. */
+auto notifyTxWhileSending() -> void {
+    FakeBackend::clear(3);
+    Queue queue{1};
+    int events{0};
+    int failedEvents{0};
+
+    FakeBackend::s_onNotifyTx = [&](int rc) {
+        ++events;
+        failedEvents += rc != 0 ? 1 : 0;
+        queue.onNotifyTx();
+
+        if (events == 1) {
+            CHECK(queue.enqueue(4, view("from event")));
+        }
+    };
+
+    CHECK(queue.enqueue(3, view("first")));
+    CHECK(sentPayload(0) == "first");
+    CHECK(sentPayload(1) == "from event");
+    CHECK(queue.pending() == 0);
+
+    /* One buffer left: the second of these is refused and its NOTIFY_TX must
+     * not count as a free buffer */
+    CHECK(queue.enqueue(3, view("a")));
+    CHECK(queue.enqueue(5, view("b")));
+    CHECK(queue.enqueue(5, view("c")));
+    CHECK(FakeBackend::s_sent.size() == 3);
+    CHECK(failedEvents == 2);
+    CHECK(events == 5);
+    CHECK(FakeBackend::s_armed.size() == 1);
+
+    /* Nothing is stranded, the retry timer sends once buffers are back */
+    FakeBackend::transmit(3);
+    CHECK(FakeBackend::fireTimers() == 1);
+    CHECK(sentPayload(3) == "bc");
+    CHECK(queue.pending() == 0);
+    CHECK(FakeBackend::s_armed.empty());
+    CHECK(queue.stats().notifications == 4 && queue.stats().stalls == 2);
+}
+
+auto wholeUpdatesOnly() -> void {
+    FakeBackend::clear(1);
+    Queue queue{1};
+
+    CHECK(queue.enqueue(7, view("0123456789")));
+    /* Three 8 byte updates: only two fit into 20 bytes, the third must not be cut */
+    CHECK(queue.enqueue(7, view("aaaaaaaa")));
+    CHECK(queue.enqueue(7, view("bbbbbbbb")));
+    CHECK(queue.enqueue(7, view("cccccccc")));
+
+    FakeBackend::transmit(2);
+    FakeBackend::fireTimers();
+    CHECK(sentPayload(1) == "aaaaaaaabbbbbbbb");
+    CHECK(sentPayload(2) == "cccccccc");
+}
+
+auto oversizedUpdates() -> void {
+    FakeBackend::clear(1);
+    Queue queue{1};
+    const std::string large(50, 'L');
+
+    CHECK(queue.enqueue(7, view("head")));
+    CHECK(queue.enqueue(7, view(large)));
+    CHECK(queue.enqueue(7, view("tail")));
+
+    FakeBackend::transmit(4);
+    FakeBackend::fireTimers();
+
+    /* The large update goes out on its own, split at the payload limit */
+    CHECK(FakeBackend::s_sent.size() == 5);
+    CHECK(sentPayload(0) == "head");
+    CHECK(sentPayload(1) == large.substr(0, 20));
+    CHECK(sentPayload(2) == large.substr(20, 20));
+    CHECK(sentPayload(3) == large.substr(40));
+    CHECK(sentPayload(4) == "tail");
+    CHECK(queue.pending() == 0);
+}
+
+/* Errors other than back-pressure drop the notification's updates, a split
+ * update as a whole, and sending carries on with the rest */
+auto sendErrors() -> void {
+    FakeBackend::clear(100);
+    Queue queue{1};
+    const std::string large(50, 'L');
+
+    FakeBackend::s_errors = 1;
+    CHECK(queue.enqueue(7, view("lost")));
+    CHECK(queue.enqueue(7, view("kept")));
+    CHECK(FakeBackend::s_sent.size() == 1 && sentPayload(0) == "kept");
+
+    FakeBackend::s_onNotify = []() {
+        /* Fail the second piece */
+        FakeBackend::s_onNotify = []() { FakeBackend::s_errors = 1; };
+    };
+    CHECK(queue.enqueue(7, view(large)));
+    CHECK(queue.enqueue(7, view("tail")));
+
+    CHECK(FakeBackend::s_sent.size() == 3);
+    CHECK(sentPayload(1) == large.substr(0, 20));
+    CHECK(sentPayload(2) == "tail");
+    CHECK(queue.pending() == 0);
+    CHECK(FakeBackend::s_armed.empty());
+
+    const Queue::Stats stats{queue.stats()};
+    CHECK(stats.sendErrors == 2 && stats.dropped == 2 && stats.stalls == 0);
+}
+
+auto resetWhileSending() -> void {
+    FakeBackend::clear(100);
+    Queue queue{1};
+
+    /* The connection is replaced while "old" is being sent. Finishing that send
+     * must neither consume the new connection's update nor count for it. */
+    FakeBackend::s_onNotify = [&queue]() {
+        queue.reset(2);
+        CHECK(queue.enqueue(5, view("new")));
+    };
+    CHECK(queue.enqueue(5, view("old")));
+
+    CHECK(FakeBackend::s_sent.size() == 2);
+    CHECK(sentPayload(0) == "old" && FakeBackend::s_sent[0].connHandle == 1);
+    CHECK(sentPayload(1) == "new" && FakeBackend::s_sent[1].connHandle == 2);
+    CHECK(queue.pending() == 0);
+    CHECK(queue.stats().notifications == 1);
+
+    /* Disconnected: nothing is queued until the next reset() */
+    queue.reset(Queue::NO_CONNECTION);
+    CHECK(!queue.enqueue(5, view("lost")));
+    CHECK(queue.stats().dropped == 1);
+    CHECK(queue.pending() == 0);
+}
+
+/* Random updates, transmits and retries; every notification has to be either
+ * whole updates of one characteristic or a piece of a single oversized one */
+auto randomStream() -> void {
+    FakeBackend::clear(2);
+    Queue queue{3};
+    std::mt19937 rng{3};
+    std::deque<Notification> accepted;
+    std::size_t acceptedBytes{0};
+
+    for (int round = 0; round < 100000; ++round) {
+        if (rng() % 3 == 0) {
+            /* Not empty, those would be ambiguous to the check below */
+            std::string value(1 + rng() % 30, '\0');
+            const auto attrHandle{static_cast<std::uint16_t>(7 + rng() % 2)};
+
+            for (char &c : value) {
+                c = static_cast<char>('a' + rng() % 26);
+            }
+
+            if (queue.enqueue(attrHandle, view(value))) {
+                acceptedBytes += value.size();
+                accepted.push_back(Notification{3, attrHandle, std::move(value)});
+            }
+        } else if (rng() % 2 == 0) {
+            FakeBackend::transmit(static_cast<int>(rng() % 3));
+        } else {
+            FakeBackend::fireTimers();
+        }
+    }
+
+    FakeBackend::transmit(1000);
+    FakeBackend::fireTimers();
+    CHECK(queue.pending() == 0);
+
+    std::size_t splitOffset{0};
+    std::size_t sentBytes{0};
+    bool matches{true};
+
+    for (const Notification &sent : FakeBackend::s_sent) {
+        sentBytes += sent.payload.size();
+        matches &= sent.payload.size() <= LIMIT && !accepted.empty() && sent.attrHandle == accepted.front().attrHandle;
+
+        if (!matches) {
+            break;
+        }
+
+        if (accepted.front().payload.size() > LIMIT) {
+            matches &= sent.payload == accepted.front().payload.substr(splitOffset, LIMIT);
+            splitOffset += sent.payload.size();
+
+            if (splitOffset == accepted.front().payload.size()) {
+                accepted.pop_front();
+                splitOffset = 0;
+            }
+            continue;
+        }
+
+        std::string packed;
+        while (!accepted.empty() && accepted.front().attrHandle == sent.attrHandle && accepted.front().payload.size() <= LIMIT &&
+               packed.size() + accepted.front().payload.size() <= sent.payload.size()) {
+            packed += accepted.front().payload;
+            accepted.pop_front();
+        }
+        matches &= packed == sent.payload;
+    }
+
+    CHECK(matches);
+    CHECK(accepted.empty());
+    CHECK(sentBytes == acceptedBytes);
+    std::printf("random stream: %u bytes in %u notifications, %u updates dropped\n",
+                unsigned(sentBytes), unsigned(FakeBackend::s_sent.size()), unsigned(queue.stats().dropped));
+}
+
+} // namespace
+
+int main() {
+    backPressureAndCoalescing();
+    notifyTxWhileSending();
+    wholeUpdatesOnly();
+    oversizedUpdates();
+    sendErrors();
+    resetWhileSending();
+    randomStream();
+
+    std::printf("%s\n", s_failed == 0 ? "all checks passed" : "checks failed");
+    return s_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,457 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Zauberzeug GmbH
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ZZ_ALLOC_H
+#define ZZ_ALLOC_H
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <type_traits>
+
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define ZZ_ALLOC_HAS_PMR 1
+#endif
+
+#include <freertos/FreeRTOS.h>
+
+#include "esp_zeug/util.h"
+
+namespace ZZ::Alloc {
+
+struct Usage {
+    std::size_t capacity;
+    std::size_t inUse;
+    std::size_t highWater;
+    std::uint32_t allocations;
+    /* Requests that could not be served, callers usually fall back to the heap */
+    std::uint32_t failures;
+};
+
+/* Counters shared by pools and arenas */
+class UsageCounter {
+    std::atomic<std::size_t> m_inUse{0};
+    std::atomic<std::size_t> m_highWater{0};
+    std::atomic<std::uint32_t> m_allocations{0};
+    std::atomic<std::uint32_t> m_failures{0};
+
+public:
+    auto allocated(std::size_t amount) -> void {
+        const std::size_t inUse{m_inUse += amount};
+        std::size_t highWater{m_highWater.load()};
+
+        while (inUse > highWater && !m_highWater.compare_exchange_weak(highWater, inUse)) {
+        }
+        ++m_allocations;
+    }
+
+    auto released(std::size_t amount) -> void {
+        m_inUse -= amount;
+    }
+
+    auto failed() -> void {
+        ++m_failures;
+    }
+
+    auto usage(std::size_t capacity) const -> Usage {
+        return Usage{capacity, m_inUse.load(), m_highWater.load(), m_allocations.load(), m_failures.load()};
+    }
+};
+
+/* Fixed-size blocks handed out from caller-owned storage, see FixedBlockPool.
+ * Each core keeps a small cache of free blocks, so the shared free list (and its
+ * cross-core spinlock) is only touched once per CACHE_BATCH operations.
+ * Usable from any task, not from ISRs. */
+class BlockPool {
+public:
+    BlockPool(const BlockPool &) = delete;
+    auto operator=(const BlockPool &) -> BlockPool & = delete;
+
+    /* nullptr once exhausted */
+    auto allocate() -> void * {
+        CoreCache &cache{m_caches[xPortGetCoreID()]};
+        void *block{nullptr};
+
+        portENTER_CRITICAL(&cache.lock);
+        if (cache.count == 0) {
+            refill(cache);
+        }
+
+        if (cache.count > 0) {
+            block = cache.blocks[--cache.count];
+        }
+        portEXIT_CRITICAL(&cache.lock);
+
+        if (block != nullptr) {
+            m_counter.allocated(1);
+        } else {
+            m_counter.failed();
+        }
+
+        return block;
+    }
+
+    auto deallocate(void *block) -> void {
+        assert(owns(block));
+        CoreCache &cache{m_caches[xPortGetCoreID()]};
+
+        portENTER_CRITICAL(&cache.lock);
+        if (cache.count == CACHE_SIZE) {
+            flush(cache);
+        }
+        cache.blocks[cache.count++] = static_cast<FreeBlock *>(block);
+        portEXIT_CRITICAL(&cache.lock);
+
+        m_counter.released(1);
+    }
+
+    auto owns(const void *ptr) const -> bool {
+        const auto *bytes{static_cast<const std::byte *>(ptr)};
+        return bytes >= m_storage && bytes < m_storage + m_blockSize * m_blockCount;
+    }
+
+    auto blockSize() const -> std::size_t {
+        return m_blockSize;
+    }
+
+    /* In blocks */
+    auto usage() const -> Usage {
+        return m_counter.usage(m_blockCount);
+    }
+
+protected:
+    BlockPool(std::byte *storage, std::size_t blockSize, std::size_t blockCount)
+        : m_storage{storage}, m_blockSize{blockSize}, m_blockCount{blockCount} {}
+
+private:
+    static constexpr std::size_t CACHE_SIZE{8};
+    static constexpr std::size_t CACHE_BATCH{CACHE_SIZE / 2};
+
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    struct CoreCache {
+        portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+        std::array<FreeBlock *, CACHE_SIZE> blocks{};
+        std::size_t count{0};
+    };
+
+    std::byte *const m_storage;
+    const std::size_t m_blockSize;
+    const std::size_t m_blockCount;
+
+    portMUX_TYPE m_lock = portMUX_INITIALIZER_UNLOCKED;
+    FreeBlock *m_freeList{nullptr};
+    /* Blocks past this index have never been handed out, which saves
+     * threading the free list through all of the storage up front */
+    std::size_t m_untouched{0};
+
+    std::array<CoreCache, portNUM_PROCESSORS> m_caches{};
+    UsageCounter m_counter;
+
+    /* Called with cache.lock held */
+    auto refill(CoreCache &cache) -> void {
+        portENTER_CRITICAL(&m_lock);
+        while (cache.count < CACHE_BATCH) {
+            FreeBlock *block{m_freeList};
+
+            if (block != nullptr) {
+                m_freeList = block->next;
+            } else if (m_untouched < m_blockCount) {
+                block = reinterpret_cast<FreeBlock *>(m_storage + m_untouched++ * m_blockSize);
+            } else {
+                break;
+            }
+
+            cache.blocks[cache.count++] = block;
+        }
+        portEXIT_CRITICAL(&m_lock);
+    }
+
+    /* Called with cache.lock held */
+    auto flush(CoreCache &cache) -> void {
+        portENTER_CRITICAL(&m_lock);
+        while (cache.count > CACHE_SIZE - CACHE_BATCH) {
+            FreeBlock *block{cache.blocks[--cache.count]};
+            block->next = m_freeList;
+            m_freeList = block;
+        }
+        portEXIT_CRITICAL(&m_lock);
+    }
+};
+
+template <std::size_t BlockSize, std::size_t BlockCount>
+class FixedBlockPool : public BlockPool {
+    static constexpr std::size_t ALIGN{alignof(std::max_align_t)};
+    /* Free blocks hold the free list link */
+    static constexpr std::size_t RAW_SIZE{BlockSize < sizeof(void *) ? sizeof(void *) : BlockSize};
+    static constexpr std::size_t ALIGNED_SIZE{(RAW_SIZE + ALIGN - 1) / ALIGN * ALIGN};
+
+    alignas(std::max_align_t) std::array<std::byte, ALIGNED_SIZE * BlockCount> m_storage;
+
+public:
+    FixedBlockPool() : BlockPool{reinterpret_cast<std::byte *>(&m_storage), ALIGNED_SIZE, BlockCount} {}
+};
+
+/* Bump allocator over caller-owned storage, see Arena. Individual allocations are
+ * never freed, the whole arena is reset (or rewound by an ArenaScope) at once,
+ * typically after a request has been handled. Not synchronized. */
+class ArenaBase {
+public:
+    ArenaBase(const ArenaBase &) = delete;
+    auto operator=(const ArenaBase &) -> ArenaBase & = delete;
+
+    /* nullptr if the request doesn't fit anymore */
+    auto allocate(std::size_t bytes, std::size_t align = alignof(std::max_align_t)) -> void * {
+        const auto base{reinterpret_cast<std::uintptr_t>(m_storage)};
+        const std::size_t offset{((base + m_used + align - 1) & ~(std::uintptr_t{align} - 1)) - base};
+
+        if (offset + bytes > m_capacity) {
+            m_counter.failed();
+            return nullptr;
+        }
+
+        m_counter.allocated(offset + bytes - m_used);
+        m_used = offset + bytes;
+
+        return m_storage + offset;
+    }
+
+    auto owns(const void *ptr) const -> bool {
+        const auto *bytes{static_cast<const std::byte *>(ptr)};
+        return bytes >= m_storage && bytes < m_storage + m_capacity;
+    }
+
+    auto mark() const -> std::size_t {
+        return m_used;
+    }
+
+    /* Drops everything allocated since mark was taken */
+    auto rewind(std::size_t mark) -> void {
+        assert(mark <= m_used);
+        m_counter.released(m_used - mark);
+        m_used = mark;
+    }
+
+    auto reset() -> void {
+        rewind(0);
+    }
+
+    /* In bytes, alignment padding included */
+    auto usage() const -> Usage {
+        return m_counter.usage(m_capacity);
+    }
+
+protected:
+    ArenaBase(std::byte *storage, std::size_t capacity)
+        : m_storage{storage}, m_capacity{capacity} {}
+
+private:
+    std::byte *const m_storage;
+    const std::size_t m_capacity;
+    std::size_t m_used{0};
+    UsageCounter m_counter;
+};
+
+template <std::size_t Size>
+class Arena : public ArenaBase {
+    alignas(std::max_align_t) std::array<std::byte, Size> m_storage;
+
+public:
+    Arena() : ArenaBase{reinterpret_cast<std::byte *>(&m_storage), Size} {}
+};
+
+/* Rewinds the arena to where it was on construction */
+class ArenaScope {
+    ArenaBase &m_arena;
+    const std::size_t m_mark;
+
+public:
+    explicit ArenaScope(ArenaBase &arena) : m_arena{arena}, m_mark{arena.mark()} {}
+
+    ArenaScope(const ArenaScope &) = delete;
+    auto operator=(const ArenaScope &) -> ArenaScope & = delete;
+
+    ~ArenaScope() {
+        m_arena.rewind(m_mark);
+    }
+};
+
+/* Standard allocator serving single objects from a BlockPool, for node based
+ * containers such as std::map or std::list. Arrays, oversized types and
+ * allocations with the pool exhausted (or no pool at all) go to the heap. */
+template <typename T>
+class PoolAllocator {
+    BlockPool *m_pool;
+
+    template <typename U>
+    friend class PoolAllocator;
+
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    PoolAllocator(BlockPool *pool = nullptr) noexcept : m_pool{pool} {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U> &other) noexcept : m_pool{other.m_pool} {}
+
+    auto allocate(std::size_t n) -> T * {
+        if (m_pool != nullptr && n == 1 && sizeof(T) <= m_pool->blockSize() && alignof(T) <= alignof(std::max_align_t)) {
+            if (void *block{m_pool->allocate()}; block != nullptr) {
+                return static_cast<T *>(block);
+            }
+        }
+
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+
+    auto deallocate(T *ptr, std::size_t) -> void {
+        if (m_pool != nullptr && m_pool->owns(ptr)) {
+            m_pool->deallocate(ptr);
+        } else {
+            ::operator delete(ptr);
+        }
+    }
+
+    template <typename U>
+    auto operator==(const PoolAllocator<U> &other) const -> bool {
+        return m_pool == other.m_pool;
+    }
+
+    template <typename U>
+    auto operator!=(const PoolAllocator<U> &other) const -> bool {
+        return m_pool != other.m_pool;
+    }
+};
+
+/* Standard allocator drawing from an arena, falling back to the heap once it is
+ * full or if there is no arena at all. Deallocation of arena memory is a no-op,
+ * it returns on rewind. */
+template <typename T>
+class ArenaAllocator {
+    ArenaBase *m_arena;
+
+    template <typename U>
+    friend class ArenaAllocator;
+
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    ArenaAllocator(ArenaBase &arena) noexcept : m_arena{&arena} {}
+
+    ArenaAllocator(ArenaBase *arena = nullptr) noexcept : m_arena{arena} {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) noexcept : m_arena{other.m_arena} {}
+
+    auto allocate(std::size_t n) -> T * {
+        if (m_arena != nullptr) {
+            if (void *mem{m_arena->allocate(n * sizeof(T), alignof(T))}; mem != nullptr) {
+                return static_cast<T *>(mem);
+            }
+        }
+
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+
+    auto deallocate(T *ptr, std::size_t) -> void {
+        if (m_arena == nullptr || !m_arena->owns(ptr)) {
+            ::operator delete(ptr);
+        }
+    }
+
+    template <typename U>
+    auto operator==(const ArenaAllocator<U> &other) const -> bool {
+        return m_arena == other.m_arena;
+    }
+
+    template <typename U>
+    auto operator!=(const ArenaAllocator<U> &other) const -> bool {
+        return m_arena != other.m_arena;
+    }
+};
+
+/* E.g. for building a response within a request, see HttpdUtil::IncomingRequest::allocator() */
+using ArenaString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+
+#ifdef ZZ_ALLOC_HAS_PMR
+/* std::pmr adaptors, for toolchains shipping <memory_resource> */
+class PoolResource : public std::pmr::memory_resource {
+    BlockPool &m_pool;
+    std::pmr::memory_resource *const m_upstream;
+
+public:
+    PoolResource(BlockPool &pool, std::pmr::memory_resource *upstream = std::pmr::new_delete_resource())
+        : m_pool{pool}, m_upstream{upstream} {}
+
+private:
+    auto do_allocate(std::size_t bytes, std::size_t align) -> void * override {
+        if (bytes <= m_pool.blockSize() && align <= alignof(std::max_align_t)) {
+            if (void *block{m_pool.allocate()}; block != nullptr) {
+                return block;
+            }
+        }
+
+        return m_upstream->allocate(bytes, align);
+    }
+
+    auto do_deallocate(void *ptr, std::size_t bytes, std::size_t align) -> void override {
+        if (m_pool.owns(ptr)) {
+            m_pool.deallocate(ptr);
+        } else {
+            m_upstream->deallocate(ptr, bytes, align);
+        }
+    }
+
+    auto do_is_equal(const std::pmr::memory_resource &other) const noexcept -> bool override {
+        return this == &other;
+    }
+};
+
+class ArenaResource : public std::pmr::memory_resource {
+    ArenaBase &m_arena;
+    std::pmr::memory_resource *const m_upstream;
+
+public:
+    ArenaResource(ArenaBase &arena, std::pmr::memory_resource *upstream = std::pmr::new_delete_resource())
+        : m_arena{arena}, m_upstream{upstream} {}
+
+private:
+    auto do_allocate(std::size_t bytes, std::size_t align) -> void * override {
+        if (void *mem{m_arena.allocate(bytes, align)}; mem != nullptr) {
+            return mem;
+        }
+
+        return m_upstream->allocate(bytes, align);
+    }
+
+    auto do_deallocate(void *ptr, std::size_t bytes, std::size_t align) -> void override {
+        if (!m_arena.owns(ptr)) {
+            m_upstream->deallocate(ptr, bytes, align);
+        }
+    }
+
+    auto do_is_equal(const std::pmr::memory_resource &other) const noexcept -> bool override {
+        return this == &other;
+    }
+};
+#endif
+
+} // namespace ZZ::Alloc
+
+#endif // ZZ_ALLOC_H
@@ -16,6 +16,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <type_traits>
 
 #include <host/ble_gatt.h>
 #include <host/ble_uuid.h>
@@ -113,6 +114,118 @@ struct Service {
     }
 };
 
+/* GATT tables resolved entirely at compile time. Every service, characteristic
+ * and descriptor is a type whose definition ends up in a static constexpr array,
+ * so the whole table lives in flash and nothing is constructed at runtime.
+ * UUIDs are referenced by templates and therefore need static storage:
+ *
+ *   constexpr auto SVC_UUID{"..."_uuid128};
+ *   constexpr auto CHR_UUID{"..."_uuid128};
+ *   std::uint16_t chrHandle;
+ *
+ *   auto onAccess(std::uint16_t conHandle, std::uint16_t attrHandle, ble_gatt_access_ctxt *ctx) -> int;
+ *
+ *   using Gatt = Static::Table<
+ *       Static::Service<SVC_UUID,
+ *                       Static::Characteristic<CHR_UUID, BLE_GATT_CHR_F_READ, onAccess, &chrHandle>>>;
+ *
+ *   Gatt::add();
+ */
+namespace Static {
+
+namespace Detail {
+/* Access callbacks may take NimBLE's arg pointer or leave it out, in which case
+ * a trampoline drops it. Either way the callback is bound at compile time. */
+template <auto Fn>
+constexpr auto accessFn() -> ble_gatt_access_fn * {
+    if constexpr (std::is_invocable_r_v<int, decltype(Fn), std::uint16_t, std::uint16_t, ble_gatt_access_ctxt *, void *>) {
+        return Fn;
+    } else {
+        static_assert(std::is_invocable_r_v<int, decltype(Fn), std::uint16_t, std::uint16_t, ble_gatt_access_ctxt *>,
+                      "Access callback must be int(uint16_t conHandle, uint16_t attrHandle, ble_gatt_access_ctxt *[, void *arg])");
+
+        return [](std::uint16_t conHandle, std::uint16_t attrHandle, ble_gatt_access_ctxt *ctx, void *) -> int {
+            return Fn(conHandle, attrHandle, ctx);
+        };
+    }
+}
+} // namespace Detail
+
+template <const auto &Uuid, std::uint8_t AttFlags, auto Fn>
+struct Descriptor {
+    static constexpr auto def() -> ble_gatt_dsc_def {
+        return ble_gatt_dsc_def{
+            &Uuid.u,
+            AttFlags,
+            0,
+            Detail::accessFn<Fn>(),
+            nullptr,
+        };
+    }
+};
+
+template <const auto &Uuid, ble_gatt_chr_flags Flags, auto Fn, std::uint16_t *ValueHandle = nullptr, typename... Descriptors>
+struct Characteristic {
+    static constexpr ble_gatt_dsc_def DESCRIPTORS[]{Descriptors::def()..., ble_gatt_dsc_def{}};
+
+    static constexpr auto def() -> ble_gatt_chr_def {
+        return ble_gatt_chr_def{
+            &Uuid.u,
+            Detail::accessFn<Fn>(),
+            nullptr,
+            /* NimBLE only ever reads descriptor definitions, the non-const
+             * pointer is an artifact of its API */
+            sizeof...(Descriptors) > 0 ? const_cast<ble_gatt_dsc_def *>(DESCRIPTORS) : nullptr,
+            Flags,
+            0,
+            ValueHandle,
+            nullptr,
+        };
+    }
+};
+
+template <std::uint8_t Type, const auto &Uuid, typename... Characteristics>
+struct ServiceOf {
+    static constexpr ble_gatt_chr_def CHARACTERISTICS[]{Characteristics::def()..., ble_gatt_chr_def{}};
+
+    static constexpr auto def() -> ble_gatt_svc_def {
+        return ble_gatt_svc_def{
+            Type,
+            &Uuid.u,
+            nullptr,
+            CHARACTERISTICS,
+        };
+    }
+};
+
+template <const auto &Uuid, typename... Characteristics>
+using Service = ServiceOf<BLE_GATT_SVC_TYPE_PRIMARY, Uuid, Characteristics...>;
+
+template <const auto &Uuid, typename... Characteristics>
+using SecondaryService = ServiceOf<BLE_GATT_SVC_TYPE_SECONDARY, Uuid, Characteristics...>;
+
+template <typename... Services>
+struct Table {
+    static constexpr ble_gatt_svc_def SERVICES[]{Services::def()..., ble_gatt_svc_def{}};
+
+    static constexpr auto defs() -> const ble_gatt_svc_def * {
+        return SERVICES;
+    }
+
+    /* Registers all services with the host, before it is started */
+    static auto add() -> int {
+        int rc{ble_gatts_count_cfg(SERVICES)};
+
+        if (rc != 0) {
+            return rc;
+        }
+
+        return ble_gatts_add_svcs(SERVICES);
+    }
+};
+
+} // namespace Static
+
 } // namespace ZZ::Ble::Gatts
 
 #endif
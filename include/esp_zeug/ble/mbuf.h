@@ -0,0 +1,147 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Zauberzeug GmbH
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ZZ_BLE_MBUF_H
+#define ZZ_BLE_MBUF_H
+
+#include <sdkconfig.h>
+#ifndef CONFIG_BT_NIMBLE_ENABLED
+#error Bluetooth NimBLE stack must be enabled in sdkconfig
+#else
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+
+#include <host/ble_gatt.h>
+#include <os/os_mbuf.h>
+
+#include "esp_zeug/util.h"
+
+/* Access to the os_mbuf chains NimBLE hands to GATT access callbacks. A long
+ * write arrives as a chain of buffers; iterating it window by window avoids
+ * flattening the value into yet another buffer:
+ *
+ *   for (const Util::ByteBufferView &window : Mbuf::windows(ctx->om)) {
+ *       parser.feed(window);
+ *   }
+ */
+namespace ZZ::Ble::Mbuf {
+
+using Util::ByteBufferView;
+
+/* Range over the data of every buffer in a chain, skipping empty ones */
+class Windows {
+public:
+    class Iterator {
+        const os_mbuf *m_om;
+
+        auto skipEmpty() -> void {
+            while (m_om != nullptr && m_om->om_len == 0) {
+                m_om = SLIST_NEXT(m_om, om_next);
+            }
+        }
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = ByteBufferView;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const ByteBufferView *;
+        using reference = ByteBufferView;
+
+        explicit Iterator(const os_mbuf *om) : m_om{om} {
+            skipEmpty();
+        }
+
+        auto operator*() const -> ByteBufferView {
+            return ByteBufferView{reinterpret_cast<const std::byte *>(m_om->om_data), m_om->om_len};
+        }
+
+        auto operator++() -> Iterator & {
+            m_om = SLIST_NEXT(m_om, om_next);
+            skipEmpty();
+            return *this;
+        }
+
+        auto operator==(const Iterator &other) const -> bool {
+            return m_om == other.m_om;
+        }
+
+        auto operator!=(const Iterator &other) const -> bool {
+            return m_om != other.m_om;
+        }
+    };
+
+    explicit Windows(const os_mbuf *om) : m_om{om} {}
+
+    auto begin() const -> Iterator {
+        return Iterator{m_om};
+    }
+
+    auto end() const -> Iterator {
+        return Iterator{nullptr};
+    }
+
+private:
+    const os_mbuf *m_om;
+};
+
+inline auto windows(const os_mbuf *om) -> Windows {
+    return Windows{om};
+}
+
+/* Total length of the chain, without relying on a packet header */
+inline auto length(const os_mbuf *om) -> std::size_t {
+    std::size_t len{0};
+
+    for (const ByteBufferView &window : windows(om)) {
+        len += window.size();
+    }
+
+    return len;
+}
+
+/* Copies up to len bytes starting at offset into dst, returns the number copied */
+inline auto copyOut(const os_mbuf *om, std::size_t offset, std::byte *dst, std::size_t len) -> std::size_t {
+    std::size_t copied{0};
+
+    for (ByteBufferView window : windows(om)) {
+        if (copied == len) {
+            break;
+        }
+
+        if (offset >= window.size()) {
+            offset -= window.size();
+            continue;
+        }
+
+        window.remove_prefix(offset);
+        offset = 0;
+
+        const std::size_t chunk{Util::minimum(window.size(), len - copied)};
+        std::memcpy(dst + copied, window.data(), chunk);
+        copied += chunk;
+    }
+
+    return copied;
+}
+
+/* Appends value to a read response, returning what the access callback should.
+ * NimBLE slices long reads by offset itself, so the full value is always appended. */
+inline auto append(os_mbuf *om, const ByteBufferView &value) -> int {
+    if (value.size() > UINT16_MAX || os_mbuf_append(om, value.data(), static_cast<std::uint16_t>(value.size())) != 0) {
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+
+    return 0;
+}
+
+} // namespace ZZ::Ble::Mbuf
+
+#endif
+
+#endif // ZZ_BLE_MBUF_H
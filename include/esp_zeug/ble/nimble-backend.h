@@ -0,0 +1,117 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Zauberzeug GmbH
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ZZ_BLE_NIMBLE_BACKEND_H
+#define ZZ_BLE_NIMBLE_BACKEND_H
+
+#include <sdkconfig.h>
+#ifndef CONFIG_BT_NIMBLE_ENABLED
+#error Bluetooth NimBLE stack must be enabled in sdkconfig
+#else
+
+#include <cstddef>
+#include <cstdint>
+
+#include <freertos/FreeRTOS.h>
+
+#include <esp_timer.h>
+#include <host/ble_hs.h>
+
+#include "esp_zeug/ble/notify-queue.h"
+#include "esp_zeug/util.h"
+
+namespace ZZ::Ble {
+
+/* Connects a NotifyQueue to the NimBLE host */
+struct NimbleBackend {
+    class Lock {
+        portMUX_TYPE m_mux = portMUX_INITIALIZER_UNLOCKED;
+
+    public:
+        auto lock() -> void {
+            portENTER_CRITICAL(&m_mux);
+        }
+
+        auto unlock() -> void {
+            portEXIT_CRITICAL(&m_mux);
+        }
+    };
+
+    /* One-shot esp_timer, created on first use so queues can be globals */
+    class Timer {
+        esp_timer_handle_t m_timer{nullptr};
+        void (*const m_fn)(void *);
+        void *const m_arg;
+
+    public:
+        Timer(void (*fn)(void *), void *arg)
+            : m_fn{fn}, m_arg{arg} {
+        }
+
+        Timer(const Timer &) = delete;
+        auto operator=(const Timer &) -> Timer & = delete;
+
+        ~Timer() {
+            if (m_timer != nullptr) {
+                esp_timer_stop(m_timer);
+                esp_timer_delete(m_timer);
+            }
+        }
+
+        /* Fails with ESP_ERR_INVALID_STATE while armed, the pending run covers this one */
+        auto start(std::uint32_t us) -> esp_err_t {
+            if (m_timer == nullptr) {
+                esp_timer_create_args_t args{};
+                args.callback = m_fn;
+                args.arg = m_arg;
+                args.dispatch_method = ESP_TIMER_TASK;
+                args.name = "zz_notify_retry";
+
+                const esp_err_t ec{esp_timer_create(&args, &m_timer)};
+
+                if (ec != ESP_OK) {
+                    m_timer = nullptr;
+                    return ec;
+                }
+            }
+
+            return esp_timer_start_once(m_timer, us);
+        }
+    };
+
+    static auto mtu(std::uint16_t connHandle) -> std::uint16_t {
+        return ble_att_mtu(connHandle);
+    }
+
+    /* ble_gatts_notify_custom() consumes the mbuf, also when it fails */
+    static auto notify(std::uint16_t connHandle, std::uint16_t attrHandle, const Util::ByteBufferView &payload) -> int {
+        os_mbuf *om{ble_hs_mbuf_from_flat(payload.data(), static_cast<std::uint16_t>(payload.size()))};
+
+        if (om == nullptr) {
+            return BLE_HS_ENOMEM;
+        }
+
+        return ble_gatts_notify_custom(connHandle, attrHandle, om);
+    }
+
+    /* The mbuf pool is used up by notifications the controller hasn't sent yet */
+    static auto isBackPressure(int rc) -> bool {
+        return rc == BLE_HS_ENOMEM;
+    }
+
+    static auto nowUs() -> std::int64_t {
+        return esp_timer_get_time();
+    }
+};
+
+template <std::size_t Capacity = 1024, std::size_t MaxPayload = 244>
+using NimbleNotifyQueue = NotifyQueue<NimbleBackend, Capacity, MaxPayload>;
+
+} // namespace ZZ::Ble
+
+#endif
+
+#endif // ZZ_BLE_NIMBLE_BACKEND_H
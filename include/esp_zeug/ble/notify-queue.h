@@ -0,0 +1,385 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Zauberzeug GmbH
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ZZ_BLE_NOTIFY_QUEUE_H
+#define ZZ_BLE_NOTIFY_QUEUE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "esp_zeug/util.h"
+
+namespace ZZ::Ble {
+
+/* Send queue for the notifications of one connection. Updates are copied into a
+ * ring of Capacity bytes and sent right away, until the host refuses one for
+ * lack of buffers. NimBLE does so with BLE_HS_ENOMEM once its mbuf pool is
+ * used up by notifications the controller hasn't sent yet. That is the only
+ * back-pressure there is: BLE_GAP_EVENT_NOTIFY_TX is raised from within
+ * ble_gatts_notify_custom(), also for failed sends, so it doesn't tell when
+ * buffers are free again. A timer retries after RETRY_US instead.
+ *
+ * While the host is busy, updates pile up; consecutive updates of the same
+ * characteristic then go out together, as many whole ones as fit into the
+ * negotiated MTU. Only an update larger than that on its own is split over
+ * several notifications, which carry nothing else. A notification refused for
+ * any other reason is dropped together with its updates.
+ *
+ * The host stack is reached through Backend, see NimbleBackend in
+ * nimble-backend.h. It provides:
+ *
+ *   Lock                       type with lock() and unlock(), guarding the queue
+ *   Timer                      type constructed from a void (*)(void *) callback
+ *                              and its argument, start(us) runs it once after us
+ *                              unless it is armed already
+ *   mtu(connHandle)            negotiated ATT MTU, 0 if not known (yet)
+ *   notify(connHandle, attrHandle, payload)
+ *                              sends one notification, 0 on success
+ *   isBackPressure(rc)         notify() failed for lack of buffers, retry later
+ *   nowUs()                    monotonic time for the throughput figures
+ *
+ * The GAP event handler has to call reset(connHandle) on BLE_GAP_EVENT_CONNECT
+ * and reset(NO_CONNECTION) on BLE_GAP_EVENT_DISCONNECT, onNotifyTx() on
+ * BLE_GAP_EVENT_NOTIFY_TX is optional. Without a connection, updates are
+ * dropped. */
+template <typename Backend, std::size_t Capacity = 1024, std::size_t MaxPayload = 244>
+class NotifyQueue {
+    static_assert(Capacity <= UINT16_MAX, "Record lengths are stored in 16 bits");
+
+public:
+    static constexpr std::uint16_t NO_CONNECTION{0xFFFF};
+    /* Delay before sending again after the host ran out of buffers, about a
+     * connection interval */
+    static constexpr std::uint32_t RETRY_US{10000};
+
+    struct Stats {
+        std::uint32_t updates;
+        std::uint32_t coalesced; /* Updates sent in the same notification as a preceding one */
+        std::uint32_t dropped;   /* Updates rejected because the queue was full or disconnected, or lost to a send error */
+        std::uint32_t notifications;
+        std::uint32_t stalls;     /* Sends refused for lack of buffers, retried later */
+        std::uint32_t sendErrors; /* Sends refused for any other reason */
+        std::uint64_t bytesSent;
+        std::int64_t elapsedUs; /* Since the first notification */
+
+        auto bytesPerSecond() const -> std::uint32_t {
+            return elapsedUs > 0 ? static_cast<std::uint32_t>(bytesSent * 1000000 / static_cast<std::uint64_t>(elapsedUs)) : 0;
+        }
+
+        template <typename String>
+        auto appendJson(String &out) const -> void {
+            Util::TextBuffer<256> buf;
+
+            buf.printf("{\"updates\":%u,\"coalesced\":%u,\"dropped\":%u,\"notifications\":%u,\"stalls\":%u,\"sendErrors\":%u,"
+                       "\"bytesSent\":%llu,\"bytesPerSecond\":%u}",
+                       unsigned(updates), unsigned(coalesced), unsigned(dropped), unsigned(notifications), unsigned(stalls), unsigned(sendErrors),
+                       static_cast<unsigned long long>(bytesSent), unsigned(bytesPerSecond()));
+            out.append(buf.data(), buf.length());
+        }
+    };
+
+    NotifyQueue() = default;
+
+    explicit NotifyQueue(std::uint16_t connHandle) {
+        reset(connHandle);
+    }
+
+    NotifyQueue(const NotifyQueue &) = delete;
+    auto operator=(const NotifyQueue &) -> NotifyQueue & = delete;
+
+    /* Binds the queue to a (new) connection or to NO_CONNECTION, dropping
+     * anything pending. A notification in flight while resetting is not
+     * accounted to the new connection. */
+    auto reset(std::uint16_t connHandle) -> void {
+        m_lock.lock();
+        ++m_generation;
+        m_connHandle = connHandle;
+        m_head = m_tail = 0;
+        m_headSent = 0;
+        m_stats = Stats{};
+        m_firstSendUs = 0;
+        m_lock.unlock();
+    }
+
+    auto connHandle() const -> std::uint16_t {
+        m_lock.lock();
+        const std::uint16_t connHandle{m_connHandle};
+        m_lock.unlock();
+
+        return connHandle;
+    }
+
+    /* Queues value for attrHandle and sends right away unless the host is busy.
+     * Returns false if the queue is full or disconnected, nothing is queued then. */
+    auto enqueue(std::uint16_t attrHandle, const Util::ByteBufferView &value) -> bool {
+        m_lock.lock();
+        const bool accepted{m_connHandle != NO_CONNECTION && push(attrHandle, value)};
+
+        if (accepted) {
+            ++m_stats.updates;
+        } else {
+            ++m_stats.dropped;
+        }
+        m_lock.unlock();
+
+        if (accepted) {
+            pump();
+        }
+
+        return accepted;
+    }
+
+    /* For BLE_GAP_EVENT_NOTIFY_TX. Raised from within the send it does nothing,
+     * any other time it is an early retry. */
+    auto onNotifyTx() -> void {
+        pump();
+    }
+
+    /* Sends pending data until the host runs out of buffers, returns the number
+     * of notifications sent. enqueue() and the retry timer pump on their own. */
+    auto pump() -> std::size_t {
+        std::size_t sent{0};
+
+        /* Whoever holds m_pumping sends, everybody else just leaves their data.
+         * The holder checks again after letting go, so nothing gets stranded. */
+        while (!m_pumping.exchange(true, std::memory_order_acquire)) {
+            const bool stalled{!sendAll(sent)};
+            m_pumping.store(false, std::memory_order_release);
+
+            if (stalled) {
+                m_retry.start(RETRY_US);
+                break;
+            }
+
+            if (pending() == 0) {
+                break;
+            }
+        }
+
+        return sent;
+    }
+
+    /* Bytes waiting to be sent, including record headers */
+    auto pending() const -> std::size_t {
+        m_lock.lock();
+        const std::size_t used{m_tail - m_head};
+        m_lock.unlock();
+
+        return used;
+    }
+
+    auto stats() const -> Stats {
+        m_lock.lock();
+        Stats stats{m_stats};
+        const std::int64_t firstSendUs{m_firstSendUs};
+        m_lock.unlock();
+
+        stats.elapsedUs = firstSendUs != 0 ? Backend::nowUs() - firstSendUs : 0;
+        return stats;
+    }
+
+private:
+    /* Records are a header followed by the value, wrapping around the ring.
+     * Every update is a record of its own. */
+    struct Header {
+        std::uint16_t attrHandle;
+        std::uint16_t len;
+    };
+
+    /* What the next notification carries and where the queue stands once it is sent */
+    struct Batch {
+        std::uint16_t attrHandle;
+        std::size_t len;
+        std::uint32_t updates; /* Completed by this notification */
+        std::uint32_t head;
+        std::uint16_t headSent;
+    };
+
+    static constexpr std::size_t HEADER_SIZE{sizeof(Header)};
+    /* Notification header: opcode and attribute handle */
+    static constexpr std::uint16_t ATT_NOTIFY_OVERHEAD{3};
+
+    mutable typename Backend::Lock m_lock{};
+    std::atomic<bool> m_pumping{false};
+    typename Backend::Timer m_retry{&NotifyQueue::retry, this};
+
+    /* Bumped by reset(), so a send that started before doesn't consume from the new ring */
+    std::uint32_t m_generation{0};
+    std::uint16_t m_connHandle{NO_CONNECTION};
+
+    std::array<std::byte, Capacity> m_ring{};
+    /* Free running offsets into m_ring */
+    std::uint32_t m_head{0};
+    std::uint32_t m_tail{0};
+    /* Bytes of the head record that have been sent already, while splitting it */
+    std::uint16_t m_headSent{0};
+
+    Stats m_stats{};
+    std::int64_t m_firstSendUs{0};
+
+    /* Only used by whoever holds m_pumping */
+    std::array<std::byte, MaxPayload> m_payload{};
+
+    static auto retry(void *queue) -> void {
+        static_cast<NotifyQueue *>(queue)->pump();
+    }
+
+    auto copyIn(std::uint32_t pos, const void *src, std::size_t len) -> void {
+        const std::size_t offset{pos % Capacity};
+        const std::size_t first{Util::minimum(len, Capacity - offset)};
+
+        std::memcpy(m_ring.data() + offset, src, first);
+        std::memcpy(m_ring.data(), static_cast<const std::byte *>(src) + first, len - first);
+    }
+
+    auto copyOut(std::uint32_t pos, void *dst, std::size_t len) const -> void {
+        const std::size_t offset{pos % Capacity};
+        const std::size_t first{Util::minimum(len, Capacity - offset)};
+
+        std::memcpy(dst, m_ring.data() + offset, first);
+        std::memcpy(static_cast<std::byte *>(dst) + first, m_ring.data(), len - first);
+    }
+
+    auto header(std::uint32_t pos) const -> Header {
+        Header header;
+        copyOut(pos, &header, HEADER_SIZE);
+        return header;
+    }
+
+    /* Called with m_lock held */
+    auto push(std::uint16_t attrHandle, const Util::ByteBufferView &value) -> bool {
+        if (HEADER_SIZE + value.size() > Capacity - (m_tail - m_head)) {
+            return false;
+        }
+
+        const Header record{attrHandle, static_cast<std::uint16_t>(value.size())};
+        copyIn(m_tail, &record, HEADER_SIZE);
+        copyIn(m_tail + HEADER_SIZE, value.data(), value.size());
+        m_tail += HEADER_SIZE + value.size();
+
+        return true;
+    }
+
+    /* Copies the next notification into m_payload: a piece of an update larger
+     * than limit, or as many whole updates of the head's characteristic as fit.
+     * Called with m_lock held and the ring not empty. */
+    auto collect(std::size_t limit) -> Batch {
+        const Header head{header(m_head)};
+
+        if (m_headSent > 0 || head.len > limit) {
+            const std::size_t len{Util::minimum<std::size_t>(head.len - m_headSent, limit)};
+            const bool last{m_headSent + len == head.len};
+            copyOut(m_head + HEADER_SIZE + m_headSent, m_payload.data(), len);
+
+            if (!last) {
+                return Batch{head.attrHandle, len, 0, m_head, static_cast<std::uint16_t>(m_headSent + len)};
+            }
+
+            return Batch{head.attrHandle, len, 1, m_head + static_cast<std::uint32_t>(HEADER_SIZE + head.len), 0};
+        }
+
+        Batch batch{head.attrHandle, 0, 0, m_head, 0};
+
+        while (batch.head != m_tail) {
+            const Header record{header(batch.head)};
+
+            if (record.attrHandle != head.attrHandle || batch.len + record.len > limit) {
+                break;
+            }
+
+            copyOut(batch.head + HEADER_SIZE, m_payload.data() + batch.len, record.len);
+            batch.len += record.len;
+            batch.head += HEADER_SIZE + record.len;
+            ++batch.updates;
+        }
+
+        return batch;
+    }
+
+    static auto payloadLimit(std::uint16_t connHandle) -> std::size_t {
+        const std::uint16_t mtu{Backend::mtu(connHandle)};
+
+        return mtu > ATT_NOTIFY_OVERHEAD ? Util::minimum<std::size_t>(mtu - ATT_NOTIFY_OVERHEAD, MaxPayload) : 0;
+    }
+
+    /* Returns false if the host is out of buffers or doesn't know the MTU yet,
+     * the data stays queued then */
+    auto sendAll(std::size_t &sent) -> bool {
+        for (;;) {
+            m_lock.lock();
+            const std::uint32_t generation{m_generation};
+            const std::uint16_t connHandle{m_connHandle};
+            const bool ready{m_head != m_tail};
+            m_lock.unlock();
+
+            if (!ready) {
+                return true;
+            }
+
+            /* Asked outside of m_lock, the host has locks of its own */
+            const std::size_t limit{payloadLimit(connHandle)};
+
+            if (limit == 0) {
+                return false;
+            }
+
+            /* Only the pumping task consumes, so the copied updates stay queued
+             * while the lock is released for sending, unless reset() intervenes */
+            m_lock.lock();
+            const bool current{m_generation == generation && m_head != m_tail};
+            const Batch batch{current ? collect(limit) : Batch{}};
+            m_lock.unlock();
+
+            if (!current) {
+                continue;
+            }
+
+            const int rc{Backend::notify(connHandle, batch.attrHandle, Util::ByteBufferView{m_payload.data(), batch.len})};
+            const std::int64_t now{Backend::nowUs()};
+
+            m_lock.lock();
+            if (m_generation != generation) {
+                /* Sent for a connection that has been reset since, the ring
+                 * belongs to the new one */
+            } else if (rc == 0) {
+                m_head = batch.head;
+                m_headSent = batch.headSent;
+                ++m_stats.notifications;
+                m_stats.coalesced += batch.updates > 1 ? batch.updates - 1 : 0;
+                m_stats.bytesSent += batch.len;
+                m_firstSendUs = m_firstSendUs != 0 ? m_firstSendUs : now;
+            } else if (Backend::isBackPressure(rc)) {
+                ++m_stats.stalls;
+            } else {
+                /* Retrying won't help, drop what was collected. The rest of an
+                 * update being split would be garbage on its own. */
+                ++m_stats.sendErrors;
+                m_stats.dropped += batch.updates;
+                m_head = batch.head;
+                m_headSent = 0;
+
+                if (batch.headSent > 0) {
+                    m_head += static_cast<std::uint32_t>(HEADER_SIZE + header(m_head).len);
+                    ++m_stats.dropped;
+                }
+            }
+            m_lock.unlock();
+
+            if (rc == 0) {
+                ++sent;
+            } else if (Backend::isBackPressure(rc)) {
+                return false;
+            }
+        }
+    }
+};
+
+} // namespace ZZ::Ble
+
+#endif // ZZ_BLE_NOTIFY_QUEUE_H
@@ -0,0 +1,318 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Zauberzeug GmbH
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ZZ_CO_TASK_H
+#define ZZ_CO_TASK_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include <esp_err.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include "esp_zeug/frtos-util.h"
+
+/* Stackless cooperative tasks: CoTask::resume() is written as a resumable state
+ * machine with the macros below, which record where to continue in m_coState.
+ * Locals do not survive an await, anything that has to goes into members, and
+ * locals with initializers need their own braced scope between two awaits. */
+#define ZZ_CO_BEGIN              \
+    switch (this->m_coState) {   \
+    case 0:
+
+#define ZZ_CO_AWAIT(wait)                                  \
+    do {                                                   \
+        this->arm(wait);                                   \
+        this->m_coState = __LINE__;                        \
+        [[fallthrough]];                                   \
+    case __LINE__:                                         \
+        if (!this->isReady()) {                            \
+            return ::ZZ::FrtosUtil::CoStatus::Pending;     \
+        }                                                  \
+    } while (false)
+
+#define ZZ_CO_YIELD() ZZ_CO_AWAIT(::ZZ::FrtosUtil::Co::yield())
+
+#define ZZ_CO_RETURN()                             \
+    do {                                           \
+        this->m_coState = 0;                       \
+        return ::ZZ::FrtosUtil::CoStatus::Done;    \
+    } while (false)
+
+#define ZZ_CO_END \
+    }             \
+    ZZ_CO_RETURN()
+
+namespace ZZ::FrtosUtil {
+
+enum class CoStatus {
+    Pending,
+    Done,
+};
+
+/* Wakes a CoTask awaiting it. Meant for a single waiter, a signal that arrives
+ * while nobody waits is kept until the next await. */
+class CoEvent {
+    std::atomic<bool> m_signalled{false};
+    std::atomic<TaskHandle_t> m_waiter{nullptr};
+
+public:
+    auto signal() -> void {
+        m_signalled.store(true, std::memory_order_release);
+        const TaskHandle_t waiter{m_waiter.load()};
+
+        if (waiter != nullptr) {
+            xTaskNotifyGive(waiter);
+        }
+    }
+
+    auto signalFromIsr() -> void {
+        m_signalled.store(true, std::memory_order_release);
+        const TaskHandle_t waiter{m_waiter.load()};
+
+        if (waiter != nullptr) {
+            BaseType_t woken{pdFALSE};
+            vTaskNotifyGiveFromISR(waiter, &woken);
+            portYIELD_FROM_ISR(woken);
+        }
+    }
+
+    /* Executor task to notify on signal() */
+    auto setWaiter(TaskHandle_t waiter) -> void {
+        m_waiter.store(waiter);
+    }
+
+    auto consume() -> bool {
+        return m_signalled.exchange(false, std::memory_order_acquire);
+    }
+};
+
+/* CoEvent carrying a result, e.g. for blocking work handed off to another Task
+ * which calls complete() once done */
+class CoCompletion : public CoEvent {
+    std::atomic<esp_err_t> m_result{ESP_OK};
+
+public:
+    auto complete(esp_err_t result) -> void {
+        m_result.store(result);
+        signal();
+    }
+
+    auto result() const -> esp_err_t {
+        return m_result.load();
+    }
+};
+
+/* What a CoTask is waiting for, built by the Co:: functions */
+struct CoWait {
+    enum Kind {
+        None,
+        Yield,
+        Delay,
+        Event,
+        Queue,
+        Poll,
+    };
+
+    using PollFn = bool (*)(void *);
+
+    Kind kind{None};
+    TickType_t until{0};
+    CoEvent *event{nullptr};
+    QueueHandle_t queue{nullptr};
+    /* Item to receive into for Queue, argument of poll for Poll */
+    void *item{nullptr};
+    PollFn poll{nullptr};
+};
+
+namespace Co {
+/* Lets every other ready CoTask run once */
+inline auto yield() -> CoWait {
+    return CoWait{CoWait::Yield};
+}
+
+inline auto delayMs(TickType_t ms) -> CoWait {
+    return CoWait{CoWait::Delay, xTaskGetTickCount() + msToTicks(ms)};
+}
+
+inline auto event(CoEvent &event) -> CoWait {
+    return CoWait{CoWait::Event, 0, &event};
+}
+
+inline auto completion(CoCompletion &completion) -> CoWait {
+    return event(completion);
+}
+
+/* Receives one item into item. FreeRTOS queues can't wake the executor,
+ * so it polls them once per tick while any CoTask waits on one. */
+inline auto receive(QueueHandle_t queue, void *item) -> CoWait {
+    return CoWait{CoWait::Queue, 0, nullptr, queue, item};
+}
+
+/* Done once poll(arg) returns true, e.g. for non-blocking operations that have
+ * to be driven by repeated calls. Polled right away, then once per tick. */
+inline auto poll(CoWait::PollFn poll, void *arg) -> CoWait {
+    return CoWait{CoWait::Poll, 0, nullptr, nullptr, arg, poll};
+}
+} // namespace Co
+
+class CoTask {
+public:
+    virtual ~CoTask() = default;
+
+    /* Implemented between ZZ_CO_BEGIN and ZZ_CO_END */
+    virtual auto resume() -> CoStatus = 0;
+
+    /* Only to be called from within resume() or by the executor */
+    auto isReady() -> bool {
+        switch (m_wait.kind) {
+        case CoWait::None:
+            return true;
+        case CoWait::Yield:
+            m_wait.kind = CoWait::None;
+            return false;
+        case CoWait::Delay:
+            if (static_cast<std::int32_t>(xTaskGetTickCount() - m_wait.until) < 0) {
+                return false;
+            }
+            break;
+        case CoWait::Event:
+            if (!m_wait.event->consume()) {
+                return false;
+            }
+            break;
+        case CoWait::Queue:
+            if (xQueueReceive(m_wait.queue, m_wait.item, 0) != pdTRUE) {
+                return false;
+            }
+            break;
+        case CoWait::Poll:
+            if (!m_wait.poll(m_wait.item)) {
+                return false;
+            }
+            break;
+        }
+
+        m_wait.kind = CoWait::None;
+        return true;
+    }
+
+protected:
+    int m_coState{0};
+
+    auto arm(const CoWait &wait) -> void {
+        m_wait = wait;
+
+        if (m_wait.kind == CoWait::Event) {
+            m_wait.event->setWaiter(xTaskGetCurrentTaskHandle());
+        }
+    }
+
+private:
+    template <std::size_t StackSize>
+    friend class CoExecutor;
+
+    CoWait m_wait{};
+    CoTask *m_next{nullptr};
+};
+
+/* Runs any number of CoTasks on a single Task. CoTasks are owned by the caller
+ * and leave the executor once resume() returns CoStatus::Done. */
+template <std::size_t StackSize = 256 * 16>
+class CoExecutor {
+    Task<StackSize> m_task;
+
+    /* Only touched by the executor task */
+    CoTask *m_running{nullptr};
+    std::size_t m_count{0};
+
+    portMUX_TYPE m_spawnLock = portMUX_INITIALIZER_UNLOCKED;
+    CoTask *m_spawned{nullptr};
+
+    auto loop() -> void {
+        portENTER_CRITICAL(&m_spawnLock);
+        while (m_spawned != nullptr) {
+            CoTask *task{m_spawned};
+            m_spawned = task->m_next;
+            task->m_next = m_running;
+            m_running = task;
+            ++m_count;
+        }
+        portEXIT_CRITICAL(&m_spawnLock);
+
+        TickType_t wait{portMAX_DELAY};
+
+        for (CoTask **iter{&m_running}; *iter != nullptr;) {
+            CoTask &task{**iter};
+
+            if (task.isReady() && task.resume() == CoStatus::Done) {
+                *iter = task.m_next;
+                task.m_next = nullptr;
+                --m_count;
+                continue;
+            }
+
+            wait = Util::minimum(wait, ticksUntilReady(task.m_wait));
+            iter = &task.m_next;
+        }
+
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+
+    static auto ticksUntilReady(const CoWait &wait) -> TickType_t {
+        switch (wait.kind) {
+        case CoWait::None:
+        case CoWait::Yield:
+            return 0;
+        case CoWait::Delay: {
+            const auto remaining{static_cast<std::int32_t>(wait.until - xTaskGetTickCount())};
+            return remaining > 0 ? static_cast<TickType_t>(remaining) : 0;
+        }
+        case CoWait::Queue:
+        case CoWait::Poll:
+            return 1;
+        case CoWait::Event:
+            break;
+        }
+
+        return portMAX_DELAY;
+    }
+
+public:
+    CoExecutor(const std::string_view &name, Core::Id coreId = Core::Any)
+        : m_task{name, coreId, [this]() { loop(); }} {}
+
+    auto run() -> void {
+        m_task.run();
+    }
+
+    /* Safe from any task, the CoTask starts on the executor's next pass */
+    auto spawn(CoTask &task) -> void {
+        portENTER_CRITICAL(&m_spawnLock);
+        task.m_next = m_spawned;
+        m_spawned = &task;
+        portEXIT_CRITICAL(&m_spawnLock);
+
+        if (m_task.handle() != nullptr) {
+            xTaskNotifyGive(m_task.handle());
+        }
+    }
+
+    /* CoTasks currently run by the executor, not counting freshly spawned ones */
+    auto taskCount() const -> std::size_t {
+        return m_count;
+    }
+};
+
+} // namespace ZZ::FrtosUtil
+
+#endif // ZZ_CO_TASK_H
@@ -0,0 +1,271 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Zauberzeug GmbH
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ZZ_CODEC_H
+#define ZZ_CODEC_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "esp_zeug/util.h"
+
+/* Bulk hex and base64 conversion between ByteBufferViews and caller-provided
+ * buffers. All functions return the number of characters or bytes written, or
+ * Codec::INVALID on malformed input or a destination that is too small; nothing
+ * is allocated and everything is usable in constant expressions. */
+namespace ZZ::Codec {
+
+using Util::ByteBufferView;
+
+static constexpr std::size_t INVALID{SIZE_MAX};
+
+enum class Base64Alphabet {
+    Standard, /* RFC 4648 section 4, '+' and '/' */
+    Url,      /* RFC 4648 section 5, '-' and '_' */
+};
+
+namespace Detail {
+static constexpr std::uint32_t ONES{0x01010101};
+static constexpr std::uint8_t BAD{0xFF};
+
+/* Four bytes as a little endian word, which is a single load on the ESP32 */
+constexpr auto loadWord(const char *src) -> std::uint32_t {
+    return static_cast<std::uint32_t>(static_cast<std::uint8_t>(src[0])) |
+           static_cast<std::uint32_t>(static_cast<std::uint8_t>(src[1])) << 8 |
+           static_cast<std::uint32_t>(static_cast<std::uint8_t>(src[2])) << 16 |
+           static_cast<std::uint32_t>(static_cast<std::uint8_t>(src[3])) << 24;
+}
+
+constexpr auto storeWord(char *dst, std::uint32_t word) -> void {
+    dst[0] = static_cast<char>(word);
+    dst[1] = static_cast<char>(word >> 8);
+    dst[2] = static_cast<char>(word >> 16);
+    dst[3] = static_cast<char>(word >> 24);
+}
+
+/* High bit set in every lane holding a byte in [lo, hi], for lanes < 0x80 */
+constexpr auto lanesBetween(std::uint32_t word, std::uint8_t lo, std::uint8_t hi) -> std::uint32_t {
+    return (word + (0x80 - lo) * ONES) & ~(word + (0x7F - hi) * ONES) & (0x80 * ONES);
+}
+
+constexpr auto makeHexTable() -> std::array<std::uint8_t, 256> {
+    std::array<std::uint8_t, 256> table{};
+
+    for (std::size_t c = 0; c < 256; ++c) {
+        table[c] = Util::isHex(static_cast<char>(c)) ? Util::hexVal(static_cast<char>(c)) : BAD;
+    }
+
+    return table;
+}
+
+constexpr auto base64Chars(Base64Alphabet alphabet) -> const char * {
+    return alphabet == Base64Alphabet::Url
+               ? "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"
+               : "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+}
+
+constexpr auto makeBase64Table(Base64Alphabet alphabet) -> std::array<std::uint8_t, 256> {
+    std::array<std::uint8_t, 256> table{};
+    const char *chars{base64Chars(alphabet)};
+
+    for (std::size_t c = 0; c < 256; ++c) {
+        table[c] = BAD;
+    }
+    for (std::uint8_t idx = 0; idx < 64; ++idx) {
+        table[static_cast<std::uint8_t>(chars[idx])] = idx;
+    }
+
+    return table;
+}
+
+inline constexpr std::array<std::uint8_t, 256> HEX_VALUES{makeHexTable()};
+inline constexpr std::array<std::uint8_t, 256> BASE64_STANDARD_VALUES{makeBase64Table(Base64Alphabet::Standard)};
+inline constexpr std::array<std::uint8_t, 256> BASE64_URL_VALUES{makeBase64Table(Base64Alphabet::Url)};
+
+constexpr auto hexValue(char c) -> std::uint8_t {
+    return HEX_VALUES[static_cast<std::uint8_t>(c)];
+}
+} // namespace Detail
+
+constexpr auto hexEncodedSize(std::size_t bytes) -> std::size_t {
+    return bytes * 2;
+}
+
+constexpr auto base64EncodedSize(std::size_t bytes) -> std::size_t {
+    return (bytes + 2) / 3 * 4;
+}
+
+/* Upper bound, padding makes the actual result up to two bytes shorter */
+constexpr auto base64DecodedSize(std::size_t chars) -> std::size_t {
+    return (chars + 3) / 4 * 3;
+}
+
+constexpr auto hexEncode(const ByteBufferView &src, char *dst, std::size_t dstLen, bool upper = false) -> std::size_t {
+    if (dstLen < hexEncodedSize(src.size())) {
+        return INVALID;
+    }
+
+    /* Added to lanes holding nibbles >= 10 on top of '0' */
+    const std::uint32_t letterOffset{upper ? 'A' - '0' - 10u : 'a' - '0' - 10u};
+    std::size_t idx{0};
+
+    /* Two bytes at a time: spread their nibbles over four lanes, then turn all
+     * lanes into ASCII at once */
+    for (; idx + 2 <= src.size(); idx += 2) {
+        const auto b0{static_cast<std::uint32_t>(src[idx])};
+        const auto b1{static_cast<std::uint32_t>(src[idx + 1])};
+        const std::uint32_t nibbles{(b0 >> 4) | (b0 & 0xF) << 8 | (b1 >> 4) << 16 | (b1 & 0xF) << 24};
+        const std::uint32_t letters{((nibbles + 0x76 * Detail::ONES) >> 7) & Detail::ONES};
+
+        Detail::storeWord(dst + idx * 2, nibbles + '0' * Detail::ONES + letters * letterOffset);
+    }
+
+    if (idx < src.size()) {
+        const char *digits{upper ? "0123456789ABCDEF" : "0123456789abcdef"};
+        const auto b{static_cast<std::uint8_t>(src[idx])};
+
+        dst[idx * 2] = digits[b >> 4];
+        dst[idx * 2 + 1] = digits[b & 0xF];
+    }
+
+    return hexEncodedSize(src.size());
+}
+
+constexpr auto hexDecode(const std::string_view &src, std::byte *dst, std::size_t dstLen) -> std::size_t {
+    if (src.size() % 2 != 0 || dstLen < src.size() / 2) {
+        return INVALID;
+    }
+
+    std::size_t idx{0};
+
+    /* Four characters at a time: validate all lanes with range checks, then map
+     * digits and letters to nibbles with a single add. Bit 6 is only set for letters. */
+    for (; idx + 4 <= src.size(); idx += 4) {
+        const std::uint32_t word{Detail::loadWord(src.data() + idx)};
+        const std::uint32_t valid{Detail::lanesBetween(word, '0', '9') |
+                                  Detail::lanesBetween(word, 'A', 'F') |
+                                  Detail::lanesBetween(word, 'a', 'f')};
+
+        if ((word & 0x80 * Detail::ONES) != 0 || valid != 0x80 * Detail::ONES) {
+            return INVALID;
+        }
+
+        const std::uint32_t nibbles{(word & 0x0F * Detail::ONES) + ((word >> 6) & Detail::ONES) * 9};
+        const std::uint32_t packed{(nibbles << 4) | (nibbles >> 8)};
+
+        dst[idx / 2] = static_cast<std::byte>(packed);
+        dst[idx / 2 + 1] = static_cast<std::byte>(packed >> 16);
+    }
+
+    if (idx < src.size()) {
+        const std::uint8_t high{Detail::hexValue(src[idx])};
+        const std::uint8_t low{Detail::hexValue(src[idx + 1])};
+
+        if (((high | low) & 0xF0) != 0) {
+            return INVALID;
+        }
+
+        dst[idx / 2] = static_cast<std::byte>(high << 4 | low);
+    }
+
+    return src.size() / 2;
+}
+
+constexpr auto base64Encode(const ByteBufferView &src, char *dst, std::size_t dstLen,
+                            Base64Alphabet alphabet = Base64Alphabet::Standard) -> std::size_t {
+    if (dstLen < base64EncodedSize(src.size())) {
+        return INVALID;
+    }
+
+    const char *chars{Detail::base64Chars(alphabet)};
+    std::size_t in{0};
+    std::size_t out{0};
+
+    for (; in + 3 <= src.size(); in += 3, out += 4) {
+        const std::uint32_t group{static_cast<std::uint32_t>(src[in]) << 16 |
+                                  static_cast<std::uint32_t>(src[in + 1]) << 8 |
+                                  static_cast<std::uint32_t>(src[in + 2])};
+
+        Detail::storeWord(dst + out, static_cast<std::uint8_t>(chars[group >> 18]) |
+                                         static_cast<std::uint8_t>(chars[(group >> 12) & 0x3F]) << 8 |
+                                         static_cast<std::uint8_t>(chars[(group >> 6) & 0x3F]) << 16 |
+                                         static_cast<std::uint32_t>(static_cast<std::uint8_t>(chars[group & 0x3F])) << 24);
+    }
+
+    if (in < src.size()) {
+        const bool two{in + 2 == src.size()};
+        const std::uint32_t group{static_cast<std::uint32_t>(src[in]) << 16 |
+                                  (two ? static_cast<std::uint32_t>(src[in + 1]) << 8 : 0)};
+
+        dst[out++] = chars[group >> 18];
+        dst[out++] = chars[(group >> 12) & 0x3F];
+        dst[out++] = two ? chars[(group >> 6) & 0x3F] : '=';
+        dst[out++] = '=';
+    }
+
+    return out;
+}
+
+/* Accepts input with or without '=' padding */
+constexpr auto base64Decode(const std::string_view &src, std::byte *dst, std::size_t dstLen,
+                            Base64Alphabet alphabet = Base64Alphabet::Standard) -> std::size_t {
+    const std::array<std::uint8_t, 256> &table{alphabet == Base64Alphabet::Url ? Detail::BASE64_URL_VALUES
+                                                                              : Detail::BASE64_STANDARD_VALUES};
+    std::size_t len{src.size()};
+
+    if (len % 4 == 0 && len > 0 && src[len - 1] == '=') {
+        len -= (src[len - 2] == '=') ? 2 : 1;
+    }
+
+    const std::size_t tail{len % 4};
+    const std::size_t decoded{len / 4 * 3 + (tail == 0 ? 0 : tail - 1)};
+
+    if (tail == 1 || dstLen < decoded) {
+        return INVALID;
+    }
+
+    std::size_t in{0};
+    std::size_t out{0};
+    /* Invalid characters map to 0xFF, OR-ing them all defers the check to the end */
+    std::uint8_t bad{0};
+
+    for (; in + 4 <= len; in += 4, out += 3) {
+        const std::uint8_t v0{table[static_cast<std::uint8_t>(src[in])]};
+        const std::uint8_t v1{table[static_cast<std::uint8_t>(src[in + 1])]};
+        const std::uint8_t v2{table[static_cast<std::uint8_t>(src[in + 2])]};
+        const std::uint8_t v3{table[static_cast<std::uint8_t>(src[in + 3])]};
+        const std::uint32_t group{static_cast<std::uint32_t>(v0) << 18 | static_cast<std::uint32_t>(v1) << 12 |
+                                  static_cast<std::uint32_t>(v2) << 6 | v3};
+
+        bad |= v0 | v1 | v2 | v3;
+        dst[out] = static_cast<std::byte>(group >> 16);
+        dst[out + 1] = static_cast<std::byte>(group >> 8);
+        dst[out + 2] = static_cast<std::byte>(group);
+    }
+
+    if (tail > 0) {
+        std::uint32_t group{0};
+
+        for (std::size_t idx = 0; idx < tail; ++idx) {
+            const std::uint8_t value{table[static_cast<std::uint8_t>(src[in + idx])]};
+            bad |= value;
+            group |= static_cast<std::uint32_t>(value & 0x3F) << (18 - 6 * idx);
+        }
+
+        dst[out++] = static_cast<std::byte>(group >> 16);
+        if (tail == 3) {
+            dst[out++] = static_cast<std::byte>(group >> 8);
+        }
+    }
+
+    return (bad & 0x80) ? INVALID : out;
+}
+
+} // namespace ZZ::Codec
+
+#endif // ZZ_CODEC_H
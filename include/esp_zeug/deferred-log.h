@@ -0,0 +1,381 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Zauberzeug GmbH
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ZZ_DEFERRED_LOG_H
+#define ZZ_DEFERRED_LOG_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+#include <sdkconfig.h>
+
+#include <freertos/FreeRTOS.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "esp_zeug/frtos-util.h"
+#include "esp_zeug/util.h"
+
+/* Logs like ESP_LOGx, but only stores the format string pointer and the raw
+ * arguments; formatting happens later in DeferredLog::drain(). The format string
+ * and any %s argument have to outlive the record, so pass string literals or
+ * copy short strings into a Util::TextBuffer, which is stored by value.
+ *
+ * The per core rings only exist with CONFIG_ZZ_DEFERRED_LOG enabled in
+ * menuconfig. Without it records are formatted and printed right away, which
+ * makes the macros behave like ESP_LOGx (and unusable from ISRs), including
+ * the per tag levels of esp_log_level_set(). */
+#define ZZ_DLOG_LEVEL(level, tag, format, ...)                                            \
+    do {                                                                                  \
+        if (LOG_LOCAL_LEVEL >= (level) && ::ZZ::DeferredLog::isEnabled((level), (tag))) { \
+            ::ZZ::DeferredLog::write((level), (tag), (format), ##__VA_ARGS__);            \
+        }                                                                                 \
+    } while (false)
+
+#define ZZ_DLOGE(tag, format, ...) ZZ_DLOG_LEVEL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define ZZ_DLOGW(tag, format, ...) ZZ_DLOG_LEVEL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define ZZ_DLOGI(tag, format, ...) ZZ_DLOG_LEVEL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define ZZ_DLOGD(tag, format, ...) ZZ_DLOG_LEVEL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define ZZ_DLOGV(tag, format, ...) ZZ_DLOG_LEVEL(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+
+namespace ZZ::DeferredLog {
+
+static constexpr std::size_t ARG_BYTES{24};
+
+struct Record;
+using FormatFn = int (*)(const Record &, char *, std::size_t);
+
+struct Record {
+    /* Sequence number + 1 of the write that filled this slot, published last */
+    std::atomic<std::uint32_t> seq{0};
+    esp_log_level_t level;
+    const char *tag;
+    const char *format;
+    FormatFn formatFn;
+    std::int64_t timestampUs;
+    alignas(8) std::array<std::byte, ARG_BYTES> args;
+};
+
+/* Layout of what DeferredLog::exportRaw() writes, resolving format and tag
+ * requires the firmware's ELF file */
+struct RawRecord {
+    std::uint32_t format;
+    std::uint32_t tag;
+    std::int64_t timestampUs;
+    std::uint8_t level;
+    std::uint8_t core;
+    std::uint8_t reserved[2];
+    std::array<std::byte, ARG_BYTES> args;
+};
+
+#ifdef CONFIG_ZZ_DEFERRED_LOG
+static constexpr std::size_t RECORDS{CONFIG_ZZ_DEFERRED_LOG_RECORDS};
+
+/* Bounded multi-producer, single-consumer ring. Writers reserve a slot by CAS
+ * on m_head and never wait: a full ring counts an overflow and drops the record.
+ * Usable from ISRs. */
+class Ring {
+    std::array<Record, RECORDS> m_records{};
+    std::atomic<std::uint32_t> m_head{0};
+    std::atomic<std::uint32_t> m_tail{0};
+    std::atomic<std::uint32_t> m_overflows{0};
+
+public:
+    template <typename Fill>
+    auto push(const Fill &fill) -> bool {
+        std::uint32_t head{m_head.load(std::memory_order_relaxed)};
+
+        do {
+            if (head - m_tail.load(std::memory_order_acquire) >= RECORDS) {
+                m_overflows.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        } while (!m_head.compare_exchange_weak(head, head + 1, std::memory_order_relaxed));
+
+        Record &record{m_records[head % RECORDS]};
+        fill(record);
+        record.seq.store(head + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    /* Oldest record if it has been published completely, consumer only */
+    auto peek() const -> const Record * {
+        const std::uint32_t tail{m_tail.load(std::memory_order_relaxed)};
+        const Record &record{m_records[tail % RECORDS]};
+
+        return record.seq.load(std::memory_order_acquire) == tail + 1 ? &record : nullptr;
+    }
+
+    auto pop() -> void {
+        m_tail.fetch_add(1, std::memory_order_release);
+    }
+
+    auto overflows() const -> std::uint32_t {
+        return m_overflows.load(std::memory_order_relaxed);
+    }
+};
+#endif
+
+namespace Detail {
+#ifdef CONFIG_ZZ_DEFERRED_LOG
+inline std::array<Ring, portNUM_PROCESSORS> rings{};
+#endif
+inline std::atomic<int> level{CONFIG_LOG_DEFAULT_LEVEL};
+
+/* What printf would see after default argument promotion, class types as they are */
+template <typename T, typename = void>
+struct Promoted {
+    using Type = decltype(+std::declval<T>());
+};
+
+template <>
+struct Promoted<float> {
+    using Type = double;
+};
+
+template <typename T>
+struct Promoted<T, std::enable_if_t<std::is_class_v<T>>> {
+    using Type = T;
+};
+
+template <typename T>
+using Stored = typename Promoted<std::decay_t<const T>>::Type;
+
+template <typename T>
+auto store(Record &record, std::size_t offset, const T &value) -> void {
+    std::memcpy(record.args.data() + offset, &value, sizeof(T));
+}
+
+template <typename T>
+auto printfArg(const T &value) -> const T & {
+    return value;
+}
+
+template <std::size_t Size>
+auto printfArg(const Util::TextBuffer<Size> &value) -> const char * {
+    return value.data();
+}
+
+template <typename... Args>
+struct Layout {
+    static constexpr auto offsets() -> std::array<std::size_t, sizeof...(Args) + 1> {
+        constexpr std::size_t sizes[]{sizeof(Args)..., 0};
+        constexpr std::size_t aligns[]{alignof(Args)..., 1};
+        std::array<std::size_t, sizeof...(Args) + 1> result{};
+        std::size_t offset{0};
+
+        for (std::size_t idx = 0; idx < sizeof...(Args) + 1; ++idx) {
+            offset = (offset + aligns[idx] - 1) / aligns[idx] * aligns[idx];
+            result[idx] = offset;
+            offset += sizes[idx];
+        }
+
+        return result;
+    }
+
+    static constexpr std::array<std::size_t, sizeof...(Args) + 1> OFFSETS{offsets()};
+};
+
+template <typename T>
+auto load(const Record &record, std::size_t offset) -> T {
+    T value;
+    std::memcpy(&value, record.args.data() + offset, sizeof(T));
+    return value;
+}
+
+template <typename... Args, std::size_t... Idx>
+auto formatUnpacked(const Record &record, char *out, std::size_t len, std::index_sequence<Idx...>) -> int {
+    if constexpr (sizeof...(Args) == 0) {
+        return std::snprintf(out, len, "%s", record.format);
+    } else {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+        return std::snprintf(out, len, record.format,
+                             printfArg(load<Args>(record, Layout<Args...>::OFFSETS[Idx]))...);
+#pragma GCC diagnostic pop
+    }
+}
+
+template <typename... Args>
+auto format(const Record &record, char *out, std::size_t len) -> int {
+    return formatUnpacked<Args...>(record, out, len, std::index_sequence_for<Args...>{});
+}
+
+inline auto levelChar(esp_log_level_t level) -> char {
+    switch (level) {
+    case ESP_LOG_ERROR:
+        return 'E';
+    case ESP_LOG_WARN:
+        return 'W';
+    case ESP_LOG_INFO:
+        return 'I';
+    case ESP_LOG_DEBUG:
+        return 'D';
+    default:
+        return 'V';
+    }
+}
+
+inline auto print(const Record &record) -> void {
+    char message[128];
+    record.formatFn(record, message, sizeof(message));
+    esp_log_write(record.level, record.tag, "%c (%u) %s: %s\n",
+                  levelChar(record.level), unsigned(record.timestampUs / 1000), record.tag, message);
+}
+} // namespace Detail
+
+inline auto isEnabled(esp_log_level_t level, const char *tag) -> bool {
+#ifdef CONFIG_ZZ_DEFERRED_LOG
+    static_cast<void>(tag);
+    return level <= Detail::level.load(std::memory_order_relaxed);
+#else
+    return level <= esp_log_level_get(tag);
+#endif
+}
+
+/* Runtime level for all deferred logging, independent of esp_log_level_set().
+ * Without CONFIG_ZZ_DEFERRED_LOG the per tag levels apply instead. */
+inline auto setLevel(esp_log_level_t level) -> void {
+    Detail::level.store(level, std::memory_order_relaxed);
+}
+
+template <typename... Args>
+auto write(esp_log_level_t level, const char *tag, const char *format, const Args &...args) -> bool {
+    using Layout = Detail::Layout<Detail::Stored<Args>...>;
+    static_assert((std::is_trivially_copyable_v<Detail::Stored<Args>> && ...), "Deferred log arguments must be trivially copyable");
+    static_assert(Layout::OFFSETS[sizeof...(Args)] <= ARG_BYTES, "Deferred log arguments exceed ARG_BYTES");
+
+    const std::int64_t now{esp_timer_get_time()};
+    const auto fill{[&](Record &record) {
+        record.level = level;
+        record.tag = tag;
+        record.format = format;
+        record.formatFn = Detail::format<Detail::Stored<Args>...>;
+        record.timestampUs = now;
+
+        std::size_t idx{0};
+        (Detail::store<Detail::Stored<Args>>(record, Layout::OFFSETS[idx++], args), ...);
+    }};
+
+#ifdef CONFIG_ZZ_DEFERRED_LOG
+    return Detail::rings[xPortGetCoreID()].push(fill);
+#else
+    Record record;
+    fill(record);
+    Detail::print(record);
+
+    return true;
+#endif
+}
+
+/* Records dropped because a ring was full */
+inline auto overflows() -> std::uint32_t {
+    std::uint32_t total{0};
+
+#ifdef CONFIG_ZZ_DEFERRED_LOG
+    for (const Ring &ring : Detail::rings) {
+        total += ring.overflows();
+    }
+#endif
+
+    return total;
+}
+
+/* Hands up to maxRecords records, merged from all cores in timestamp order, to fn.
+ * Only one task at a time may drain. Returns the number of records handled. */
+inline auto drain(const std::function<void(const Record &, std::uint8_t core)> &fn,
+                  std::size_t maxRecords = SIZE_MAX) -> std::size_t {
+    std::size_t handled{0};
+
+#ifdef CONFIG_ZZ_DEFERRED_LOG
+
+    for (; handled < maxRecords; ++handled) {
+        const Record *oldest{nullptr};
+        std::uint8_t oldestCore{0};
+
+        for (std::uint8_t core = 0; core < Detail::rings.size(); ++core) {
+            const Record *record{Detail::rings[core].peek()};
+
+            if (record != nullptr && (oldest == nullptr || record->timestampUs < oldest->timestampUs)) {
+                oldest = record;
+                oldestCore = core;
+            }
+        }
+
+        if (oldest == nullptr) {
+            break;
+        }
+
+        fn(*oldest, oldestCore);
+        Detail::rings[oldestCore].pop();
+    }
+#else
+    static_cast<void>(fn);
+    static_cast<void>(maxRecords);
+#endif
+
+    return handled;
+}
+
+inline auto format(const Record &record, char *out, std::size_t len) -> int {
+    return record.formatFn(record, out, len);
+}
+
+/* Formats and prints pending records through esp_log_write() */
+inline auto drainToConsole(std::size_t maxRecords = SIZE_MAX) -> std::size_t {
+    return drain([](const Record &record, std::uint8_t) { Detail::print(record); }, maxRecords);
+}
+
+/* Copies pending records unformatted into dst, e.g. to be sent by a GetHandler.
+ * Returns the number of bytes written, always a multiple of sizeof(RawRecord). */
+inline auto exportRaw(std::byte *dst, std::size_t len) -> std::size_t {
+    const std::size_t records{drain(
+        [&dst](const Record &record, std::uint8_t core) {
+            RawRecord raw{
+                static_cast<std::uint32_t>(reinterpret_cast<std::uintptr_t>(record.format)),
+                static_cast<std::uint32_t>(reinterpret_cast<std::uintptr_t>(record.tag)),
+                record.timestampUs,
+                static_cast<std::uint8_t>(record.level),
+                core,
+                {},
+                record.args,
+            };
+            std::memcpy(dst, &raw, sizeof(raw));
+            dst += sizeof(raw);
+        },
+        len / sizeof(RawRecord))};
+
+    return records * sizeof(RawRecord);
+}
+
+/* Low priority task printing deferred records every periodMs */
+template <std::size_t StackSize = 256 * 16>
+class DrainTask {
+    FrtosUtil::Task<StackSize> m_task;
+
+public:
+    DrainTask(TickType_t periodMs = 100, UBaseType_t priority = tskIDLE_PRIORITY + 1)
+        : m_task{"zz-dlog", periodMs, []() { drainToConsole(); }} {
+        m_task.setPriority(priority);
+    }
+
+    auto run() -> void {
+        m_task.run();
+    }
+};
+
+} // namespace ZZ::DeferredLog
+
+#endif // ZZ_DEFERRED_LOG_H
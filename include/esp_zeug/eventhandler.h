@@ -7,15 +7,223 @@
 #ifndef ZZ_EVENTHANDLER_H
 #define ZZ_EVENTHANDLER_H
 
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <functional>
+#include <string>
+
+#include <freertos/FreeRTOS.h>
 
 #include <esp_err.h>
 #include <esp_event.h>
+#include <esp_timer.h>
 
+#include "esp_zeug/frtos-util.h"
 #include "esp_zeug/util.h"
 
 namespace ZZ {
 
+/* Optional dispatch instrumentation, attached to an EventHandler via attachStats().
+ *
+ * Posts made through EventHandler::postMainLoop() of eventIds the handler is
+ * registered for are timestamped and matched against their dispatch in FIFO
+ * order per eventId, which gives the time an event waited in the loop queue.
+ * Matching assumes the handler is the only poster of its eventIds on its base;
+ * dispatches that don't match a pending post are counted as unmatched and
+ * excluded from the latency histogram. Posts of different eventIds are never
+ * matched against each other, as posts from several tasks may reach the queue
+ * in a different order than they took their slots. Posts finding all pending
+ * slots taken are counted as untracked and are not part of inFlight. */
+class EventStats : public FrtosUtil::Registry<EventStats> {
+public:
+    static constexpr std::size_t HISTOGRAM_BUCKETS{16};
+    using Histogram = Util::Log2Histogram<HISTOGRAM_BUCKETS>;
+
+    struct Snapshot {
+        esp_event_base_t eventBase;
+        std::uint32_t posted;
+        std::uint32_t postFailures;
+        std::uint32_t dispatched;
+        std::uint32_t unmatched;
+        std::uint32_t untracked;
+        std::int32_t inFlight;
+        std::int32_t inFlightHighWater;
+        Histogram latencyUs;
+        Histogram callbackUs;
+    };
+
+    /* Listed in the registry for its whole lifetime */
+    EventStats(esp_event_base_t eventBase) : m_eventBase{eventBase} {
+        link();
+    }
+
+    struct PostToken {
+        std::uint32_t seq;
+        bool tracked;
+    };
+
+    /* Called by the posting task right before esp_event_post(), since the
+     * dispatch may well happen before the post call returns */
+    auto beginPost(int32_t eventId) -> PostToken {
+        std::int32_t inFlight{0};
+
+        portENTER_CRITICAL(&m_pendingLock);
+        PostToken token{m_pendingTail, false};
+
+        if (token.seq - m_pendingHead < PENDING_SLOTS) {
+            m_pending[token.seq % PENDING_SLOTS] = Pending{esp_timer_get_time(), eventId, true};
+            ++m_pendingTail;
+            token.tracked = true;
+            inFlight = ++m_inFlight;
+        }
+        portEXIT_CRITICAL(&m_pendingLock);
+
+        if (!token.tracked) {
+            ++m_untracked;
+            return token;
+        }
+
+        std::int32_t highWater{m_inFlightHighWater.load()};
+
+        while (inFlight > highWater && !m_inFlightHighWater.compare_exchange_weak(highWater, inFlight)) {
+        }
+
+        return token;
+    }
+
+    auto endPost(const PostToken &token, esp_err_t ec) -> void {
+        if (ec == ESP_OK) {
+            ++m_posted;
+            return;
+        }
+
+        ++m_postFailures;
+
+        if (!token.tracked) {
+            return;
+        }
+
+        portENTER_CRITICAL(&m_pendingLock);
+        if (token.seq - m_pendingHead < m_pendingTail - m_pendingHead &&
+            m_pending[token.seq % PENDING_SLOTS].valid) {
+            m_pending[token.seq % PENDING_SLOTS].valid = false;
+            --m_inFlight;
+            dropReleased();
+        }
+        portEXIT_CRITICAL(&m_pendingLock);
+    }
+
+    /* Returns the dispatch timestamp to be handed to endDispatch() */
+    auto beginDispatch(int32_t eventId) -> std::int64_t {
+        const std::int64_t now{esp_timer_get_time()};
+        bool matched{false};
+        std::int64_t postedAt{0};
+
+        portENTER_CRITICAL(&m_pendingLock);
+        for (std::uint32_t seq = m_pendingHead; seq != m_pendingTail; ++seq) {
+            Pending &pending{m_pending[seq % PENDING_SLOTS]};
+
+            if (pending.valid && pending.eventId == eventId) {
+                postedAt = pending.timestamp;
+                matched = true;
+                pending.valid = false;
+                --m_inFlight;
+                dropReleased();
+                break;
+            }
+        }
+        portEXIT_CRITICAL(&m_pendingLock);
+
+        if (matched) {
+            m_latencyUs.record(clampUs(now - postedAt));
+        } else {
+            ++m_unmatched;
+        }
+
+        return now;
+    }
+
+    auto endDispatch(std::int64_t startedAt) -> void {
+        ++m_dispatched;
+        m_callbackUs.record(clampUs(esp_timer_get_time() - startedAt));
+    }
+
+    /* Histograms are only written from the event loop task, a snapshot taken
+     * elsewhere may be off by the event currently being dispatched */
+    auto snapshot() const -> Snapshot {
+        return Snapshot{
+            m_eventBase,
+            m_posted.load(),
+            m_postFailures.load(),
+            m_dispatched.load(),
+            m_unmatched.load(),
+            m_untracked.load(),
+            m_inFlight.load(),
+            m_inFlightHighWater.load(),
+            m_latencyUs,
+            m_callbackUs,
+        };
+    }
+
+    template <typename String>
+    auto appendJson(String &out) const -> void {
+        const Snapshot snap{snapshot()};
+        Util::TextBuffer<224> buf;
+
+        buf.printf("{\"base\":\"%s\",\"posted\":%u,\"postFailures\":%u,\"dispatched\":%u,"
+                   "\"unmatched\":%u,\"untracked\":%u,\"inFlight\":%d,\"inFlightHighWater\":%d,",
+                   snap.eventBase, unsigned(snap.posted), unsigned(snap.postFailures), unsigned(snap.dispatched),
+                   unsigned(snap.unmatched), unsigned(snap.untracked),
+                   int(snap.inFlight), int(snap.inFlightHighWater));
+        out.append(buf.data(), buf.length());
+
+        out.append("\"latencyUs\":");
+        snap.latencyUs.appendJson(out);
+        out.append(",\"callbackUs\":");
+        snap.callbackUs.appendJson(out);
+        out.append("}");
+    }
+
+private:
+    static constexpr std::uint32_t PENDING_SLOTS{16};
+
+    struct Pending {
+        std::int64_t timestamp;
+        int32_t eventId;
+        bool valid;
+    };
+
+    const esp_event_base_t m_eventBase;
+
+    std::atomic<std::uint32_t> m_posted{0};
+    std::atomic<std::uint32_t> m_postFailures{0};
+    std::atomic<std::uint32_t> m_dispatched{0};
+    std::atomic<std::uint32_t> m_unmatched{0};
+    std::atomic<std::uint32_t> m_untracked{0};
+    std::atomic<std::int32_t> m_inFlight{0};
+    std::atomic<std::int32_t> m_inFlightHighWater{0};
+
+    portMUX_TYPE m_pendingLock = portMUX_INITIALIZER_UNLOCKED;
+    std::array<Pending, PENDING_SLOTS> m_pending{};
+    std::uint32_t m_pendingHead{0};
+    std::uint32_t m_pendingTail{0};
+
+    Histogram m_latencyUs;
+    Histogram m_callbackUs;
+
+    /* Frees slots at the head that have been matched or failed, called with m_pendingLock held */
+    auto dropReleased() -> void {
+        while (m_pendingHead != m_pendingTail && !m_pending[m_pendingHead % PENDING_SLOTS].valid) {
+            ++m_pendingHead;
+        }
+    }
+
+    static auto clampUs(std::int64_t us) -> std::uint32_t {
+        return us < 0 ? 0 : (us > INT32_MAX ? INT32_MAX : static_cast<std::uint32_t>(us));
+    }
+};
+
 class EventHandler {
 public:
     using Callback = std::function<void(int32_t, void *)>;
@@ -26,6 +234,11 @@ public:
     EventHandler(esp_event_base_t eventBase, int32_t eventId, Callback cb)
         : m_eventBase{eventBase}, m_eventId{eventId}, m_cb{cb} {}
 
+    /* Has to happen before registerMainLoop(), stats must outlive the handler */
+    auto attachStats(EventStats *stats) -> void {
+        m_stats = stats;
+    }
+
     auto registerMainLoop() -> esp_err_t {
         return esp_event_handler_instance_register(m_eventBase,
                                                    m_eventId,
@@ -36,11 +249,16 @@ public:
     auto postMainLoop(int32_t eventId,
                       const Util::ByteBufferView &data = Util::ByteBufferView{},
                       TickType_t ticksToWait = portMAX_DELAY) -> esp_err_t {
-        /* esp_event_post taking void* instead of const void* for event_data
-         * has to be a defect */
-        return esp_event_post(m_eventBase, eventId,
-                              const_cast<void *>(reinterpret_cast<const void *>(data.data())),
-                              data.size(), ticksToWait);
+        /* Posts this handler won't see can't be matched to a dispatch */
+        if (m_stats == nullptr || (m_eventId != ESP_EVENT_ANY_ID && eventId != m_eventId)) {
+            return postNative(eventId, data, ticksToWait);
+        }
+
+        const EventStats::PostToken token{m_stats->beginPost(eventId)};
+        const esp_err_t ec{postNative(eventId, data, ticksToWait)};
+        m_stats->endPost(token, ec);
+
+        return ec;
     }
 
 private:
@@ -48,11 +266,28 @@ private:
     int32_t m_eventId;
     esp_event_handler_instance_t m_instance{nullptr};
     Callback m_cb;
+    EventStats *m_stats{nullptr};
+
+    auto postNative(int32_t eventId, const Util::ByteBufferView &data, TickType_t ticksToWait) -> esp_err_t {
+        /* esp_event_post taking void* instead of const void* for event_data
+         * has to be a defect */
+        return esp_event_post(m_eventBase, eventId,
+                              const_cast<void *>(reinterpret_cast<const void *>(data.data())),
+                              data.size(), ticksToWait);
+    }
 
     static auto nativeHandler(void *ctx, esp_event_base_t,
                               int32_t eventId, void *eventData) -> void {
         auto &self = *static_cast<EventHandler *>(ctx);
+
+        if (self.m_stats == nullptr) {
+            self.m_cb(eventId, eventData);
+            return;
+        }
+
+        const std::int64_t startedAt{self.m_stats->beginDispatch(eventId)};
         self.m_cb(eventId, eventData);
+        self.m_stats->endDispatch(startedAt);
     }
 };
 
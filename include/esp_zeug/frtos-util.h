@@ -9,14 +9,17 @@
 
 #include <array>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
 #include <functional>
+#include <string>
 #include <string_view>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 
 #include <esp_log.h>
+#include <esp_timer.h>
 
 #include "util.h"
 
@@ -40,6 +43,226 @@ static auto idToStr(BaseType_t id) -> const char * {
 }
 } // namespace Core
 
+/* Rounds up, so a non-zero delay never turns into a mere yield. Written
+ * without ms + period - 1, which would overflow for delays close to portMAX_DELAY. */
+constexpr auto msToTicks(TickType_t ms) -> TickType_t {
+    return ms / portTICK_PERIOD_MS + (ms % portTICK_PERIOD_MS != 0 ? 1 : 0);
+}
+
+/* What a fixed-rate Task does with releases that passed while an iteration overran */
+enum class CatchUp {
+    Skip,  /* drop them and continue with the next release still ahead */
+    Burst, /* run the missed iterations back to back */
+};
+
+/* Intrusive list of all live instances of T, which derives from Registry<T>
+ * and implements appendJson(std::string &). Meant for statistics objects that
+ * are reported together, e.g. by a GetHandler. */
+template <typename T>
+class Registry {
+public:
+    Registry(const Registry &) = delete;
+    auto operator=(const Registry &) -> Registry & = delete;
+
+    /* Calls fn for every linked instance, none may be unlinked while this is running */
+    static auto forEach(const std::function<void(const T &)> &fn) -> void {
+        portENTER_CRITICAL(&s_lock);
+        Registry *iter{s_head};
+        portEXIT_CRITICAL(&s_lock);
+
+        for (; iter != nullptr; iter = iter->m_next) {
+            fn(static_cast<const T &>(*iter));
+        }
+    }
+
+    /* JSON array of all linked instances, out is a std::string or any other
+     * std::basic_string<char>, e.g. an Alloc::ArenaString */
+    template <typename String>
+    static auto reportJson(String &out) -> void {
+        bool first{true};
+
+        out.append("[");
+        forEach([&](const T &instance) {
+            if (!first) {
+                out.append(",");
+            }
+            first = false;
+            instance.appendJson(out);
+        });
+        out.append("]");
+    }
+
+protected:
+    Registry() = default;
+
+    ~Registry() {
+        unlink();
+    }
+
+    auto link() -> void {
+        portENTER_CRITICAL(&s_lock);
+        m_next = s_head;
+        s_head = this;
+        portEXIT_CRITICAL(&s_lock);
+    }
+
+    /* Does nothing if not linked */
+    auto unlink() -> void {
+        portENTER_CRITICAL(&s_lock);
+        for (Registry **iter{&s_head}; *iter != nullptr; iter = &(*iter)->m_next) {
+            if (*iter == this) {
+                *iter = m_next;
+                break;
+            }
+        }
+        portEXIT_CRITICAL(&s_lock);
+    }
+
+    /* First linked instance pred holds for, nullptr if there is none */
+    static auto find(const std::function<bool(const T &)> &pred) -> T * {
+        T *found{nullptr};
+
+        portENTER_CRITICAL(&s_lock);
+        for (Registry *iter{s_head}; iter != nullptr && found == nullptr; iter = iter->m_next) {
+            if (pred(static_cast<const T &>(*iter))) {
+                found = static_cast<T *>(iter);
+            }
+        }
+        portEXIT_CRITICAL(&s_lock);
+
+        return found;
+    }
+
+private:
+    Registry *m_next{nullptr};
+
+    static inline portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+    static inline Registry *s_head{nullptr};
+};
+
+/* Timing of a fixed-rate Task, see Task::setFixedRate() */
+struct RateStats {
+    using Histogram = Util::Log2Histogram<16>;
+
+    std::uint32_t iterations{0};
+    /* Iterations whose entrypoint alone took longer than the period */
+    std::uint32_t overruns{0};
+    /* Iterations which finished after the following release */
+    std::uint32_t deadlineMisses{0};
+    /* Releases dropped by CatchUp::Skip */
+    std::uint32_t skipped{0};
+    /* Deviation of each release from the period */
+    Histogram jitterUs;
+};
+
+/* Runtime statistics of a Task, see Task::enableTelemetry(). Listed in the
+ * registry while the Task runs. */
+class TaskTelemetry : public Registry<TaskTelemetry> {
+public:
+    using Histogram = Util::Log2Histogram<16>;
+
+    struct Snapshot {
+        const char *name;
+        BaseType_t coreId;
+        std::uint32_t iterations;
+        /* Wall time spent in the entrypoint, including time preempted */
+        std::uint64_t busyWallUs;
+        /* CPU time of the whole task in run time stats clock ticks (µs with the
+         * esp_timer source), 0 without CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS */
+        std::uint64_t cpuRunTime;
+        Histogram iterationUs;
+        std::size_t stackSize;
+        /* Minimum of stack left unused so far, in StackType_t units */
+        std::uint32_t stackHighWaterMark;
+    };
+
+    TaskTelemetry() = default;
+
+    ~TaskTelemetry() {
+        detach();
+    }
+
+    /* Lists the running task in the registry */
+    auto attach(const std::string_view &name, std::size_t stackSize, TaskHandle_t task, BaseType_t coreId) -> void {
+        m_name.printf("%.*s", static_cast<int>(name.size()), name.data());
+        m_stackSize = stackSize;
+        m_task = task;
+        m_coreId = coreId;
+        link();
+    }
+
+    auto detach() -> void {
+        unlink();
+        m_task = nullptr;
+    }
+
+    /* For tasks deleting themselves, which can't know their Task object */
+    static auto detachTask(TaskHandle_t task) -> void {
+        TaskTelemetry *telemetry{find([task](const TaskTelemetry &entry) { return entry.m_task == task; })};
+
+        if (telemetry != nullptr) {
+            telemetry->detach();
+        }
+    }
+
+    auto record(std::uint32_t us) -> void {
+        ++m_iterations;
+        m_busyWallUs += us;
+        m_iterationUs.record(us);
+    }
+
+    auto snapshot() const -> Snapshot {
+        return Snapshot{
+            m_name.data(),
+            m_coreId,
+            m_iterations,
+            m_busyWallUs,
+            cpuRunTime(),
+            m_iterationUs,
+            m_stackSize,
+            m_task != nullptr ? static_cast<std::uint32_t>(uxTaskGetStackHighWaterMark(m_task)) : 0,
+        };
+    }
+
+    template <typename String>
+    auto appendJson(String &out) const -> void {
+        const Snapshot snap{snapshot()};
+        Util::TextBuffer<128> buf;
+
+        buf.printf("{\"name\":\"%s\",\"core\":\"%s\",\"iterations\":%u,\"busyWallUs\":%llu,",
+                   snap.name, Core::idToStr(snap.coreId), unsigned(snap.iterations), static_cast<unsigned long long>(snap.busyWallUs));
+        out.append(buf.data(), buf.length());
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+        buf.printf("\"cpuRunTime\":%llu,", static_cast<unsigned long long>(snap.cpuRunTime));
+        out.append(buf.data(), buf.length());
+#endif
+        out.append("\"iterationUs\":");
+        snap.iterationUs.appendJson(out);
+
+        buf.printf(",\"stackSize\":%u,\"stackHighWaterMark\":%u}",
+                   unsigned(snap.stackSize), unsigned(snap.stackHighWaterMark));
+        out.append(buf.data(), buf.length());
+    }
+
+private:
+    auto cpuRunTime() const -> std::uint64_t {
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+        return m_task != nullptr ? ulTaskGetRunTimeCounter(m_task) : 0;
+#else
+        return 0;
+#endif
+    }
+
+    Util::TextBuffer<16> m_name;
+    std::size_t m_stackSize{0};
+    TaskHandle_t m_task{nullptr};
+    BaseType_t m_coreId{Core::Any};
+
+    std::uint32_t m_iterations{0};
+    std::uint64_t m_busyWallUs{0};
+    Histogram m_iterationUs;
+};
+
 template <std::size_t StackSize = 256 * 16>
 class Task {
     using Entrypoint = std::function<void()>;
@@ -52,6 +275,13 @@ class Task {
 
     TaskHandle_t m_task{nullptr};
 
+    UBaseType_t m_priority{DEFAULT_PRIORITY};
+    bool m_fixedRate{false};
+    CatchUp m_catchUp{CatchUp::Skip};
+    /* Both optional and owned by the caller */
+    RateStats *m_rateStats{nullptr};
+    TaskTelemetry *m_telemetry{nullptr};
+
     /* FreeRTOS internal */
     StaticTask_t m_taskBuffer;
     StackType_t m_stack[StackSize];
@@ -61,13 +291,77 @@ class Task {
         auto id{xPortGetCoreID()};
 
         ESP_LOGI("esp_zeug/FrtosUtil", "Task [%.*s] executing on core [%s]", self.m_name.length(), self.m_name.data(), Core::idToStr(id));
+        if (self.m_telemetry != nullptr) {
+            self.m_telemetry->attach(std::string_view{self.m_name.data(), self.m_name.length()}, StackSize, xTaskGetCurrentTaskHandle(), id);
+        }
+
+        if (self.m_fixedRate) {
+            self.runFixedRate();
+        }
 
         while (true) {
-            self.m_entrypoint();
+            self.runEntrypoint();
             delayMiliSeconds(self.m_loopDelay);
         }
     }
 
+    auto runEntrypoint() -> void {
+        if (m_telemetry == nullptr) {
+            m_entrypoint();
+            return;
+        }
+
+        const std::int64_t start{esp_timer_get_time()};
+        m_entrypoint();
+        m_telemetry->record(static_cast<std::uint32_t>(esp_timer_get_time() - start));
+    }
+
+    /* Releases happen at absolute tick counts, so neither the entrypoint's
+     * runtime nor a late wakeup shifts the ones that follow */
+    auto runFixedRate() -> void {
+        const TickType_t period{msToTicks(m_loopDelay)};
+        const std::int64_t periodUs{static_cast<std::int64_t>(period) * portTICK_PERIOD_MS * 1000};
+        assert(period > 0);
+
+        TickType_t lastWake{xTaskGetTickCount()};
+        std::int64_t prevStart{-1};
+        RateStats unused;
+        RateStats &stats{m_rateStats != nullptr ? *m_rateStats : unused};
+
+        while (true) {
+            const std::int64_t start{esp_timer_get_time()};
+
+            if (m_rateStats != nullptr && prevStart >= 0) {
+                const std::int64_t deviation{start - prevStart - periodUs};
+                stats.jitterUs.record(static_cast<std::uint32_t>(deviation < 0 ? -deviation : deviation));
+            }
+            prevStart = start;
+
+            runEntrypoint();
+            ++stats.iterations;
+
+            if (esp_timer_get_time() - start > periodUs) {
+                ++stats.overruns;
+            }
+
+            const TickType_t elapsed{xTaskGetTickCount() - lastWake};
+
+            if (elapsed > period) {
+                ++stats.deadlineMisses;
+
+                if (m_catchUp == CatchUp::Skip) {
+                    /* Move lastWake to the latest release already passed, so the
+                     * delay below waits for the first one still in the future */
+                    const TickType_t passed{elapsed / period};
+                    stats.skipped += passed;
+                    lastWake += passed * period;
+                }
+            }
+
+            vTaskDelayUntil(&lastWake, period);
+        }
+    }
+
 public:
     Task(const std::string_view &name, Entrypoint entrypoint)
         : m_name{name}, m_loopDelay{0}, m_coreId{Core::Any}, m_entrypoint{entrypoint} {
@@ -85,29 +379,63 @@ public:
         : m_name{name}, m_loopDelay{loopDelayMs}, m_coreId{coreId}, m_entrypoint{entrypoint} {
     }
 
+    /* Turns the loop delay into a fixed period measured from one release to the next.
+     * Has to be called before run(), the period is rounded up to whole ticks.
+     * stats, if given, has to outlive the task and is written by it unsynchronized,
+     * so readers may see counters one iteration apart. */
+    auto setFixedRate(CatchUp policy = CatchUp::Skip, RateStats *stats = nullptr) -> void {
+        assert(m_task == nullptr);
+        assert(m_loopDelay > 0);
+        m_fixedRate = true;
+        m_catchUp = policy;
+        m_rateStats = stats;
+    }
+
+    /* Has to be called before run() */
+    auto setPriority(UBaseType_t priority) -> void {
+        assert(m_task == nullptr);
+        m_priority = priority;
+    }
+
+    /* Times every iteration into telemetry, which is listed in the TaskTelemetry
+     * registry while the task runs and has to outlive it. Has to be called before run(). */
+    auto enableTelemetry(TaskTelemetry &telemetry) -> void {
+        assert(m_task == nullptr);
+        m_telemetry = &telemetry;
+    }
+
     auto run() -> void {
         assert(m_task == nullptr);
         m_task = xTaskCreateStaticPinnedToCore(nativeFunction,
                                                m_name.data(),
                                                StackSize,
                                                this,
-                                               DEFAULT_PRIORITY,
+                                               m_priority,
                                                m_stack,
                                                &m_taskBuffer,
                                                m_coreId);
     }
 
+    /* nullptr until run() has been called */
+    auto handle() const -> TaskHandle_t {
+        return m_task;
+    }
+
     auto halt() -> void {
         assert(m_task != nullptr);
+        if (m_telemetry != nullptr) {
+            m_telemetry->detach();
+        }
         vTaskDelete(m_task);
     }
 
     static auto haltCurrent() -> void {
+        TaskTelemetry::detachTask(xTaskGetCurrentTaskHandle());
         vTaskDelete(nullptr);
     }
 
     static auto delayMiliSeconds(TickType_t ms) -> void {
-        vTaskDelay(ms / portTICK_PERIOD_MS);
+        vTaskDelay(msToTicks(ms));
     }
 
     static auto delaySeconds(float seconds) -> void {
@@ -21,23 +21,41 @@
 #include <esp_http_server.h>
 #include <esp_log.h>
 
+#include "esp_zeug/alloc.h"
+#include "esp_zeug/co-task.h"
+#include "esp_zeug/deferred-log.h"
 #include "esp_zeug/util.h"
 
 namespace ZZ::HttpdUtil {
 /* Server helpers */
 
-/* Wrapper class results in identical code being generated: https://godbolt.org/z/MYYxfTTfv */
+/* Thin wrapper passed by value: the request handle plus the optional arena
+ * the handler allocates from */
 struct IncomingRequest {
     httpd_req_t *m_req;
+    Alloc::ArenaBase *m_arena;
 
-    IncomingRequest(httpd_req_t *wrappedHandle)
-        : m_req{wrappedHandle} {
+    IncomingRequest(httpd_req_t *wrappedHandle, Alloc::ArenaBase *arena = nullptr)
+        : m_req{wrappedHandle}, m_arena{arena} {
     }
 
     operator httpd_req_t *() {
         return m_req;
     }
 
+    /* Scratch memory released once the handler returns, nullptr unless the
+     * endpoint has an arena, see EndpointHandler::setArena() */
+    auto arena() -> Alloc::ArenaBase * {
+        return m_arena;
+    }
+
+    /* Allocator for anything built while handling the request, e.g. an
+     * Alloc::ArenaString holding the response. Falls back to the heap. */
+    template <typename T = char>
+    auto allocator() -> Alloc::ArenaAllocator<T> {
+        return Alloc::ArenaAllocator<T>{m_arena};
+    }
+
     auto setHeaderField(const char *field, const char *value) -> esp_err_t {
         return httpd_resp_set_hdr(m_req, field, value);
     }
@@ -117,13 +135,20 @@ class EndpointHandler {
     const ResponseType m_type;
     const Callback m_callback;
     httpd_uri_t m_nativeHandler;
+    Alloc::ArenaBase *m_arena{nullptr};
 
     static auto invoke(httpd_req_t *req) -> esp_err_t {
         auto &self = *static_cast<const EndpointHandler*>(req->user_ctx);
-        IncomingRequest wrappedReq{req};
+        IncomingRequest wrappedReq{req, self.m_arena};
 
-        ESP_LOGD("esp_zeug/HttpdUtil", "Invoking endpoint handler [%s]", self.m_endpoint.c_str());
+        ZZ_DLOGD("esp_zeug/HttpdUtil", "Invoking endpoint handler [%s]", self.m_endpoint.c_str());
         self.m_type.apply(wrappedReq);
+
+        if (self.m_arena == nullptr) {
+            return self.m_callback(wrappedReq);
+        }
+
+        Alloc::ArenaScope scope{*self.m_arena};
         return self.m_callback(wrappedReq);
     }
 
@@ -141,6 +166,13 @@ public:
         m_nativeHandler.user_ctx = this;
     }
 
+    /* Serves IncomingRequest::allocator() from arena, rewound after every request.
+     * A server runs one handler at a time, so its endpoints may share an arena.
+     * Has to be called before registerWithServer(). */
+    auto setArena(Alloc::ArenaBase &arena) -> void {
+        m_arena = &arena;
+    }
+
     /* Calling this more than once results in undefined behavior */
     auto registerWithServer(httpd_handle_t server) const -> esp_err_t {
         return httpd_register_uri_handler(server, &m_nativeHandler);
@@ -157,6 +189,7 @@ struct OutgoingRequest {
 
     esp_http_client_handle_t m_handle;
     const EventCallback m_callback;
+    esp_err_t m_asyncResult{ESP_OK};
 
     static auto nativeCallback(esp_http_client_event_handle_t event) -> esp_err_t {
         OutgoingRequest &self{*reinterpret_cast<OutgoingRequest *>(event->user_data)};
@@ -164,6 +197,13 @@ struct OutgoingRequest {
         return self.m_callback(event);
     }
 
+    static auto pollPerform(void *ctx) -> bool {
+        OutgoingRequest &self{*static_cast<OutgoingRequest *>(ctx)};
+        self.m_asyncResult = esp_http_client_perform(self.m_handle);
+
+        return self.m_asyncResult != ESP_ERR_HTTP_EAGAIN;
+    }
+
     OutgoingRequest(esp_http_client_config_t config, EventCallback callback)
         : m_callback{callback} {
         config.user_data = this;
@@ -175,6 +215,17 @@ struct OutgoingRequest {
         return esp_http_client_perform(m_handle);
     }
 
+    /* perform() for CoTasks, to be awaited with ZZ_CO_AWAIT. Each poll advances the
+     * request without blocking the executor, which requires is_async in the config
+     * (only supported for HTTPS by esp_http_client). The outcome is asyncResult(). */
+    auto performAsync() -> FrtosUtil::CoWait {
+        return FrtosUtil::Co::poll(pollPerform, this);
+    }
+
+    auto asyncResult() const -> esp_err_t {
+        return m_asyncResult;
+    }
+
     ~OutgoingRequest() {
         esp_http_client_cleanup(m_handle);
     }
@@ -0,0 +1,411 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Zauberzeug GmbH
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ZZ_JOB_SCHEDULER_H
+#define ZZ_JOB_SCHEDULER_H
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_timer.h>
+
+#include "esp_zeug/frtos-util.h"
+#include "esp_zeug/util.h"
+
+namespace ZZ::FrtosUtil {
+
+class TimerWheel;
+template <std::size_t StackSize>
+class JobScheduler;
+
+/* A periodic or one-shot unit of work run by a JobScheduler.
+ * Jobs are owned by the caller and must outlive their scheduling. */
+class Job {
+public:
+    using Callback = std::function<void()>;
+
+    Job(const std::string_view &name, Callback callback)
+        : m_name{name}, m_callback{callback} {}
+
+    Job(const Job &) = delete;
+    auto operator=(const Job &) -> Job & = delete;
+
+    auto name() const -> const char * {
+        return m_name.data();
+    }
+
+    auto isScheduled() const -> bool {
+        return m_pprev != nullptr;
+    }
+
+    auto runs() const -> std::uint32_t {
+        return m_runs;
+    }
+
+    /* Periodic runs which started at least one period late */
+    auto lateRuns() const -> std::uint32_t {
+        return m_lateRuns;
+    }
+
+    auto totalUs() const -> std::uint64_t {
+        return m_totalUs;
+    }
+
+    auto maxUs() const -> std::uint32_t {
+        return m_maxUs;
+    }
+
+private:
+    friend class TimerWheel;
+    template <std::size_t StackSize>
+    friend class JobScheduler;
+
+    const Util::TextBuffer<16> m_name;
+    const Callback m_callback;
+
+    /* Intrusive list linkage, m_pprev points at whatever points at us */
+    Job *m_next{nullptr};
+    Job **m_pprev{nullptr};
+    TickType_t m_expires{0};
+    TickType_t m_period{0};
+
+    std::uint32_t m_runs{0};
+    std::uint32_t m_lateRuns{0};
+    std::uint64_t m_totalUs{0};
+    std::uint32_t m_maxUs{0};
+
+    auto execute() -> void {
+        const std::int64_t start{esp_timer_get_time()};
+        m_callback();
+        const auto elapsed{static_cast<std::uint32_t>(esp_timer_get_time() - start)};
+
+        ++m_runs;
+        m_totalUs += elapsed;
+        m_maxUs = (elapsed > m_maxUs) ? elapsed : m_maxUs;
+    }
+};
+
+/* Hierarchical timer wheel with a 256 slot root level of one tick each and three
+ * 64 slot levels above it, covering 2^26 ticks. Jobs further out are parked in the
+ * outermost level and re-filed when it cascades. Insert and remove are O(1).
+ * Not synchronized, JobScheduler guards it with a spinlock. */
+class TimerWheel {
+    static constexpr unsigned ROOT_BITS{8};
+    static constexpr unsigned LEVEL_BITS{6};
+    static constexpr unsigned LEVELS{3};
+    static constexpr TickType_t ROOT_SIZE{1u << ROOT_BITS};
+    static constexpr TickType_t LEVEL_SIZE{1u << LEVEL_BITS};
+    static constexpr TickType_t ROOT_MASK{ROOT_SIZE - 1};
+    static constexpr TickType_t LEVEL_MASK{LEVEL_SIZE - 1};
+    static constexpr TickType_t MAX_DELTA{(TickType_t{1} << (ROOT_BITS + LEVELS * LEVEL_BITS)) - 1};
+
+    std::array<Job *, ROOT_SIZE> m_root{};
+    std::array<std::array<Job *, LEVEL_SIZE>, LEVELS> m_levels{};
+    std::array<std::uint32_t, ROOT_SIZE / 32> m_rootOccupied{};
+
+    /* Next tick to be processed */
+    TickType_t m_now;
+    std::size_t m_count{0};
+
+    static auto link(Job *&head, Job &job) -> void {
+        job.m_next = head;
+        job.m_pprev = &head;
+
+        if (head != nullptr) {
+            head->m_pprev = &job.m_next;
+        }
+        head = &job;
+    }
+
+    static auto shift(unsigned level) -> unsigned {
+        return ROOT_BITS + level * LEVEL_BITS;
+    }
+
+    auto file(Job &job) -> void {
+        const auto delta{static_cast<std::int32_t>(job.m_expires - m_now)};
+
+        if (delta < static_cast<std::int32_t>(ROOT_SIZE)) {
+            /* Anything overdue goes into the slot processed next */
+            const TickType_t idx{(delta < 0 ? m_now : job.m_expires) & ROOT_MASK};
+            link(m_root[idx], job);
+            m_rootOccupied[idx / 32] |= std::uint32_t{1} << (idx % 32);
+            return;
+        }
+
+        const TickType_t expires{static_cast<TickType_t>(delta) > MAX_DELTA ? m_now + MAX_DELTA : job.m_expires};
+
+        for (unsigned level = 0; level < LEVELS; ++level) {
+            if (static_cast<TickType_t>(delta) < (TickType_t{1} << shift(level + 1)) || level == LEVELS - 1) {
+                link(m_levels[level][(expires >> shift(level)) & LEVEL_MASK], job);
+                return;
+            }
+        }
+    }
+
+    /* Re-files all jobs of a slot against the current time, returns the slot index */
+    auto cascade(unsigned level) -> TickType_t {
+        const TickType_t idx{(m_now >> shift(level)) & LEVEL_MASK};
+        Job *iter{m_levels[level][idx]};
+        m_levels[level][idx] = nullptr;
+
+        while (iter != nullptr) {
+            Job &job{*iter};
+            iter = job.m_next;
+            file(job);
+        }
+
+        return idx;
+    }
+
+public:
+    explicit TimerWheel(TickType_t now) : m_now{now} {}
+
+    auto now() const -> TickType_t {
+        return m_now;
+    }
+
+    auto count() const -> std::size_t {
+        return m_count;
+    }
+
+    /* Moves an empty wheel to now, so it doesn't have to step through the idle time */
+    auto resync(TickType_t now) -> void {
+        assert(m_count == 0);
+        m_now = now;
+    }
+
+    /* Advances now() over ticks without work, at most ticksUntilNext() of them */
+    auto skip(TickType_t ticks) -> void {
+        assert(ticks <= ticksUntilNext());
+        m_now += ticks;
+    }
+
+    /* job.m_expires has to be set by the caller */
+    auto insert(Job &job) -> void {
+        assert(!job.isScheduled());
+        file(job);
+        ++m_count;
+    }
+
+    /* Works for jobs in the wheel as well as in a list returned from step() */
+    auto remove(Job &job) -> void {
+        assert(job.isScheduled());
+        *job.m_pprev = job.m_next;
+
+        if (job.m_next != nullptr) {
+            job.m_next->m_pprev = job.m_pprev;
+        }
+
+        job.m_next = nullptr;
+        job.m_pprev = nullptr;
+        --m_count;
+    }
+
+    /* Processes tick now() and hands out the jobs due in it through expired */
+    auto step(Job *&expired) -> void {
+        const TickType_t rootIdx{m_now & ROOT_MASK};
+
+        if (rootIdx == 0) {
+            for (unsigned level = 0; level < LEVELS && cascade(level) == 0; ++level) {
+            }
+        }
+
+        expired = m_root[rootIdx];
+        m_root[rootIdx] = nullptr;
+        m_rootOccupied[rootIdx / 32] &= ~(std::uint32_t{1} << (rootIdx % 32));
+
+        if (expired != nullptr) {
+            expired->m_pprev = &expired;
+        }
+
+        ++m_now;
+    }
+
+    /* Ticks from now() until the next step() that has work to do, which is either
+     * an occupied root slot or the next cascade. portMAX_DELAY if the wheel is empty. */
+    auto ticksUntilNext() const -> TickType_t {
+        if (m_count == 0) {
+            return portMAX_DELAY;
+        }
+
+        const TickType_t start{m_now & ROOT_MASK};
+        const TickType_t untilCascade{(ROOT_SIZE - start) & ROOT_MASK};
+
+        if (untilCascade == 0) {
+            return 0;
+        }
+
+        for (TickType_t dist = 0; dist < untilCascade;) {
+            const TickType_t idx{(start + dist) & ROOT_MASK};
+            const std::uint32_t word{m_rootOccupied[idx / 32] >> (idx % 32)};
+
+            if (word != 0) {
+                return Util::minimum<TickType_t>(dist + __builtin_ctz(word), untilCascade);
+            }
+
+            dist += 32 - (idx % 32);
+        }
+
+        return untilCascade;
+    }
+};
+
+/* Runs many periodic and one-shot Jobs on a single Task, instead of spending a full
+ * static stack on each of them. Periodic jobs are released at fixed multiples of
+ * their period; a run that starts a period or more late resynchronizes to the
+ * current tick and is counted in Job::lateRuns(). Callbacks run one after the
+ * other, a slow one delays all others. Not usable from ISRs. */
+template <std::size_t StackSize = 256 * 16>
+class JobScheduler {
+    Task<StackSize> m_task;
+    portMUX_TYPE m_lock = portMUX_INITIALIZER_UNLOCKED;
+    TimerWheel m_wheel;
+
+    auto enqueue(Job &job, TickType_t delayTicks, TickType_t periodTicks) -> void {
+        portENTER_CRITICAL(&m_lock);
+        if (job.isScheduled()) {
+            m_wheel.remove(job);
+        }
+
+        const TickType_t now{xTaskGetTickCount()};
+
+        if (m_wheel.count() == 0) {
+            m_wheel.resync(now);
+        }
+
+        job.m_expires = now + delayTicks;
+        job.m_period = periodTicks;
+        m_wheel.insert(job);
+        portEXIT_CRITICAL(&m_lock);
+
+        if (m_task.handle() != nullptr) {
+            xTaskNotifyGive(m_task.handle());
+        }
+    }
+
+    auto loop() -> void {
+        portENTER_CRITICAL(&m_lock);
+        for (;;) {
+            const TickType_t now{xTaskGetTickCount()};
+
+            if (m_wheel.count() == 0) {
+                m_wheel.resync(now);
+                break;
+            }
+
+            const auto behind{static_cast<std::int32_t>(now - m_wheel.now())};
+
+            if (behind < 0) {
+                break;
+            }
+
+            /* Ticks without work are skipped in one go, only the ones holding
+             * jobs or a cascade are stepped through */
+            m_wheel.skip(Util::minimum<TickType_t>(m_wheel.ticksUntilNext(), static_cast<TickType_t>(behind) + 1));
+
+            if (static_cast<std::int32_t>(now - m_wheel.now()) < 0) {
+                break;
+            }
+
+            Job *expired{nullptr};
+            m_wheel.step(expired);
+
+            while (expired != nullptr) {
+                Job &job{*expired};
+                m_wheel.remove(job);
+
+                portEXIT_CRITICAL(&m_lock);
+                job.execute();
+                portENTER_CRITICAL(&m_lock);
+
+                /* Neither cancelled nor rescheduled from within the callback */
+                if (job.m_period > 0 && !job.isScheduled()) {
+                    job.m_expires += job.m_period;
+
+                    if (static_cast<std::int32_t>(job.m_expires - m_wheel.now()) < 0) {
+                        ++job.m_lateRuns;
+                        job.m_expires = m_wheel.now();
+                    }
+
+                    m_wheel.insert(job);
+                }
+            }
+
+            /* Catching up may take many steps, don't hold the lock across all of them */
+            portEXIT_CRITICAL(&m_lock);
+            portENTER_CRITICAL(&m_lock);
+        }
+
+        const TickType_t untilNext{m_wheel.ticksUntilNext()};
+        const TickType_t target{m_wheel.now() + untilNext};
+        portEXIT_CRITICAL(&m_lock);
+
+        TickType_t wait{portMAX_DELAY};
+
+        if (untilNext != portMAX_DELAY) {
+            const auto remaining{static_cast<std::int32_t>(target - xTaskGetTickCount())};
+            wait = remaining > 0 ? static_cast<TickType_t>(remaining) : 0;
+        }
+
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+
+public:
+    JobScheduler(const std::string_view &name, Core::Id coreId = Core::Any)
+        : m_task{name, coreId, [this]() { loop(); }}, m_wheel{xTaskGetTickCount()} {}
+
+    auto run() -> void {
+        m_task.run();
+    }
+
+    /* One-shot run after delayMs, replaces any previous schedule of job */
+    auto scheduleIn(Job &job, TickType_t delayMs) -> void {
+        enqueue(job, msToTicks(delayMs), 0);
+    }
+
+    /* Periodic runs, the first one after firstDelayMs */
+    auto scheduleEvery(Job &job, TickType_t periodMs, TickType_t firstDelayMs = 0) -> void {
+        assert(msToTicks(periodMs) > 0);
+        enqueue(job, msToTicks(firstDelayMs), msToTicks(periodMs));
+    }
+
+    /* Safe to call from within the job's own callback. Returns whether the job was pending. */
+    auto cancel(Job &job) -> bool {
+        portENTER_CRITICAL(&m_lock);
+        const bool wasScheduled{job.isScheduled()};
+
+        if (wasScheduled) {
+            m_wheel.remove(job);
+        }
+        job.m_period = 0;
+        portEXIT_CRITICAL(&m_lock);
+
+        return wasScheduled;
+    }
+
+    auto jobCount() const -> std::size_t {
+        return m_wheel.count();
+    }
+
+    /* Internal RAM saved by the currently scheduled jobs sharing this scheduler,
+     * compared to each of them running its own Task<StackSize> */
+    auto ramSavedBytes() const -> std::int32_t {
+        const std::size_t jobs{jobCount()};
+        return static_cast<std::int32_t>(jobs * sizeof(Task<StackSize>)) -
+               static_cast<std::int32_t>(sizeof(*this) + jobs * sizeof(Job));
+    }
+};
+
+} // namespace ZZ::FrtosUtil
+
+#endif // ZZ_JOB_SCHEDULER_H
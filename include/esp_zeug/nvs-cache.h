@@ -10,11 +10,14 @@
 #include <cstdint>
 #include <map>
 #include <string>
+#include <utility>
 #include <variant>
 
 #include <esp_err.h>
 #include <nvs_flash.h>
 
+#include "esp_zeug/alloc.h"
+
 namespace ZZ {
 
 namespace NvsType {
@@ -45,7 +48,12 @@ public:
     using InvalidType = std::monostate;
     using Value = std::variant<InvalidType, std::string, int16_t>;
 
-    NvsCache(const std::string_view &nspace);
+    /* Map node: key, value and tree linkage */
+    static constexpr std::size_t NODE_SIZE_HINT{sizeof(std::pair<const std::string, Value>) + 4 * sizeof(void *)};
+
+    /* Cache entries are allocated from pool if given, which needs blocks of at
+     * least NODE_SIZE_HINT bytes to be of any use */
+    NvsCache(const std::string_view &nspace, Alloc::BlockPool *pool = nullptr);
     ~NvsCache();
 
     auto init(nvs_open_mode_t mode) -> esp_err_t;
@@ -95,9 +103,12 @@ public:
 private:
     static const nvs_handle_t NULL_HANDLE;
 
+    /* Transparent comparison, so lookups by const char * don't build a std::string */
+    using CacheMap = std::map<std::string, Value, std::less<>,
+                              Alloc::PoolAllocator<std::pair<const std::string, Value>>>;
+
     nvs_handle_t m_handle;
     std::string m_nspace;
-    using CacheMap = std::map<std::string, Value>;
     CacheMap m_cacheMap;
 };
 
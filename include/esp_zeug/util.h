@@ -9,6 +9,7 @@
 
 #include <array>
 #include <cassert>
+#include <cmath>
 #include <cstdarg>
 #include <cstddef>
 #include <cstdint>
@@ -16,16 +17,417 @@
 #include <cstring>
 #include <string>
 #include <string_view>
+#include <type_traits>
+
+/* Format string for TextBuffer::format(), parsed and checked against the
+ * arguments at compile time. Placeholders are {} or {:spec} with spec being
+ * [0][width][.precision][x|X], literal braces are written as {{ and }}. */
+#define ZZ_FMT(literal)                                                       \
+    [] {                                                                      \
+        struct FormatString {                                                 \
+            static constexpr auto str() -> std::string_view { return literal; } \
+        };                                                                    \
+        return FormatString{};                                                \
+    }()
 
 namespace ZZ::Util {
 
 using ByteBufferView = std::basic_string_view<std::byte>;
 
 template <typename T>
-auto minimum(const T &a, const T &b) -> const T & {
+constexpr auto minimum(const T &a, const T &b) -> const T & {
     return (a < b) ? a : b;
 }
 
+namespace Fmt {
+struct Spec {
+    /* '\0' for the type's default, 'x' or 'X' for hexadecimal integers */
+    char type{'\0'};
+    char fill{' '};
+    std::uint8_t width{0};
+    /* Digits after the decimal point for floating point, printf's 6 if unset */
+    std::int8_t precision{-1};
+};
+
+struct Segment {
+    /* Literal text [begin, begin + length) of the format string, unless isArg */
+    std::size_t begin{0};
+    std::size_t length{0};
+    bool isArg{false};
+    Spec spec{};
+};
+
+struct Parsed {
+    std::size_t segments;
+    std::size_t args;
+    bool valid;
+};
+
+static constexpr int MAX_WIDTH{64};
+static constexpr int MAX_PRECISION{9};
+
+/* Counts segments if out is nullptr, stores them otherwise */
+constexpr auto scan(std::string_view fmt, Segment *out) -> Parsed {
+    constexpr int OUT_OF_RANGE{1000};
+    Parsed result{0, 0, true};
+    std::size_t idx{0};
+
+    auto emit{[&](const Segment &segment) {
+        if (out != nullptr) {
+            out[result.segments] = segment;
+        }
+        ++result.segments;
+    }};
+
+    auto isDigit{[&]() { return idx < fmt.size() && fmt[idx] >= '0' && fmt[idx] <= '9'; }};
+
+    while (idx < fmt.size()) {
+        const char c{fmt[idx]};
+        const bool doubled{idx + 1 < fmt.size() && fmt[idx + 1] == c};
+
+        if ((c == '{' || c == '}') && doubled) {
+            emit(Segment{idx, 1});
+            idx += 2;
+        } else if (c == '}') {
+            result.valid = false;
+            break;
+        } else if (c == '{') {
+            Spec spec{};
+            int width{0};
+            int precision{-1};
+            ++idx;
+
+            if (idx < fmt.size() && fmt[idx] == ':') {
+                ++idx;
+
+                if (idx < fmt.size() && fmt[idx] == '0') {
+                    spec.fill = '0';
+                    ++idx;
+                }
+
+                /* Accumulated wider than the Spec fields and saturated, so that
+                 * e.g. {:256} is rejected below instead of wrapping around */
+                for (; isDigit(); ++idx) {
+                    width = minimum(width * 10 + (fmt[idx] - '0'), OUT_OF_RANGE);
+                }
+
+                if (idx < fmt.size() && fmt[idx] == '.') {
+                    ++idx;
+                    precision = 0;
+
+                    for (; isDigit(); ++idx) {
+                        precision = minimum(precision * 10 + (fmt[idx] - '0'), OUT_OF_RANGE);
+                    }
+                }
+
+                if (idx < fmt.size() && (fmt[idx] == 'x' || fmt[idx] == 'X')) {
+                    spec.type = fmt[idx++];
+                }
+            }
+
+            if (idx >= fmt.size() || fmt[idx] != '}' || width > MAX_WIDTH || precision > MAX_PRECISION) {
+                result.valid = false;
+                break;
+            }
+
+            spec.width = static_cast<std::uint8_t>(width);
+            spec.precision = static_cast<std::int8_t>(precision);
+
+            ++idx;
+            emit(Segment{0, 0, true, spec});
+            ++result.args;
+        } else {
+            const std::size_t begin{idx};
+
+            while (idx < fmt.size() && fmt[idx] != '{' && fmt[idx] != '}') {
+                ++idx;
+            }
+            emit(Segment{begin, idx - begin});
+        }
+    }
+
+    return result;
+}
+
+template <typename FormatString>
+struct Compiled {
+    static constexpr std::string_view STR{FormatString::str()};
+    static constexpr Parsed INFO{scan(STR, nullptr)};
+
+    static constexpr auto segments() -> std::array<Segment, INFO.segments> {
+        std::array<Segment, INFO.segments> result{};
+        scan(STR, result.data());
+        return result;
+    }
+
+    static constexpr std::array<Segment, INFO.segments> SEGMENTS{segments()};
+};
+
+/* Appends to a fixed buffer, dropping whatever doesn't fit */
+class Writer {
+    char *const m_buf;
+    const std::size_t m_capacity;
+    std::size_t m_len;
+    bool m_overflow{false};
+
+public:
+    Writer(char *buf, std::size_t capacity, std::size_t len)
+        : m_buf{buf}, m_capacity{capacity}, m_len{len} {}
+
+    auto put(const char *str, std::size_t len) -> void {
+        const std::size_t count{minimum(len, m_capacity - m_len)};
+        std::memcpy(m_buf + m_len, str, count);
+        m_len += count;
+        m_overflow |= (count != len);
+    }
+
+    auto put(char c, std::size_t count = 1) -> void {
+        const std::size_t fit{minimum(count, m_capacity - m_len)};
+        std::memset(m_buf + m_len, c, fit);
+        m_len += fit;
+        m_overflow |= (fit != count);
+    }
+
+    auto overflowed() const -> bool {
+        return m_overflow;
+    }
+
+    /* Terminates the string, returns its length */
+    auto finish() -> std::size_t {
+        m_buf[m_len] = '\0';
+        return m_len;
+    }
+};
+
+constexpr auto makeDigitPairs() -> std::array<char, 200> {
+    std::array<char, 200> pairs{};
+
+    for (std::size_t idx = 0; idx < 100; ++idx) {
+        pairs[idx * 2] = static_cast<char>('0' + idx / 10);
+        pairs[idx * 2 + 1] = static_cast<char>('0' + idx % 10);
+    }
+
+    return pairs;
+}
+
+inline constexpr std::array<char, 200> DIGIT_PAIRS{makeDigitPairs()};
+inline constexpr std::uint32_t POW10[]{1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+/* Writes the digits of value backwards ending at end, returns the first one */
+template <typename U>
+auto toDecimal(U value, char *end) -> char * {
+    while (value >= 100) {
+        const std::size_t idx{static_cast<std::size_t>(value % 100) * 2};
+        value /= 100;
+        *--end = DIGIT_PAIRS[idx + 1];
+        *--end = DIGIT_PAIRS[idx];
+    }
+
+    if (value >= 10) {
+        *--end = DIGIT_PAIRS[value * 2 + 1];
+        *--end = DIGIT_PAIRS[value * 2];
+    } else {
+        *--end = static_cast<char>('0' + value);
+    }
+
+    return end;
+}
+
+template <typename U>
+auto toHex(U value, char *end, bool upper) -> char * {
+    const char *digits{upper ? "0123456789ABCDEF" : "0123456789abcdef"};
+
+    do {
+        *--end = digits[value & 0xF];
+        value >>= 4;
+    } while (value != 0);
+
+    return end;
+}
+
+/* Sign, padding and digits; zero padding goes between sign and digits */
+inline auto putNumber(Writer &writer, const Spec &spec, bool negative, const char *digits, std::size_t len) -> void {
+    const std::size_t total{len + (negative ? 1 : 0)};
+    const std::size_t padding{spec.width > total ? spec.width - total : 0};
+
+    if (spec.fill != '0') {
+        writer.put(' ', padding);
+    }
+    if (negative) {
+        writer.put('-');
+    }
+    if (spec.fill == '0') {
+        writer.put('0', padding);
+    }
+
+    writer.put(digits, len);
+}
+
+inline auto putString(Writer &writer, const Spec &spec, const char *str, std::size_t len) -> void {
+    if (spec.width > len) {
+        writer.put(' ', spec.width - len);
+    }
+    writer.put(str, len);
+}
+
+template <typename T>
+auto putInteger(Writer &writer, const Spec &spec, T value) -> void {
+    /* 32 bit division is native on the ESP32, 64 bit isn't */
+    using U = std::conditional_t<(sizeof(T) > 4), std::uint64_t, std::uint32_t>;
+    char buf[24];
+    char *const end{buf + sizeof(buf)};
+    char *begin;
+    bool negative{false};
+
+    if (spec.type == 'x' || spec.type == 'X') {
+        begin = toHex(static_cast<std::make_unsigned_t<T>>(value), end, spec.type == 'X');
+    } else if constexpr (std::is_signed_v<T>) {
+        negative = value < 0;
+        /* Negating in the unsigned domain is fine for the minimum value as well */
+        begin = toDecimal(negative ? U(0) - static_cast<U>(value) : static_cast<U>(value), end);
+    } else {
+        begin = toDecimal(static_cast<U>(value), end);
+    }
+
+    putNumber(writer, spec, negative, begin, end - begin);
+}
+
+/* Beyond the fixed point range, also catches infinity. Rare enough to pay for
+ * printf; kept out of line so only this path pays for the buffer, which fits
+ * DBL_MAX with MAX_PRECISION digits. */
+__attribute__((noinline)) inline auto putFloatPrintf(Writer &writer, const Spec &spec, int precision, bool negative, double magnitude) -> void {
+    char buf[320];
+    const int len{std::snprintf(buf, sizeof(buf), "%.*f", precision, magnitude)};
+    putNumber(writer, spec, negative, buf, minimum<std::size_t>(len, sizeof(buf) - 1));
+}
+
+/* magnitude * scale rounded to an integer like printf does: on the exact
+ * binary value, ties to even. The product's rounding error is recovered with
+ * Dekker's two-product, so no fused multiply-add is needed. */
+inline auto roundScaled(double magnitude, double scale) -> std::uint64_t {
+    constexpr double SPLIT{134217729.0}; /* 2^27 + 1 */
+    const double product{magnitude * scale};
+
+    const double magnitudeSplit{magnitude * SPLIT};
+    const double magnitudeHigh{magnitudeSplit - (magnitudeSplit - magnitude)};
+    const double magnitudeLow{magnitude - magnitudeHigh};
+    const double scaleSplit{scale * SPLIT};
+    const double scaleHigh{scaleSplit - (scaleSplit - scale)};
+    const double scaleLow{scale - scaleHigh};
+    /* magnitude * scale == product + error exactly */
+    const double error{((magnitudeHigh * scaleHigh - product) + magnitudeHigh * scaleLow + magnitudeLow * scaleHigh) +
+                       magnitudeLow * scaleLow};
+
+    const auto truncated{static_cast<std::uint64_t>(product)};
+
+    if (product >= 9007199254740992.0) {
+        /* From 2^53 on product is an even integer and the error may exceed one.
+         * rint() rounds ties to even, which keeps the sum's tie rule as well. */
+        return truncated + static_cast<std::int64_t>(std::rint(error));
+    }
+
+    /* Exact whenever the fraction is near one half, the only case where the
+     * small error can decide; the sum rounds but keeps its sign */
+    const double aboveHalf{(product - static_cast<double>(truncated) - 0.5) + error};
+
+    return (aboveHalf > 0 || (aboveHalf == 0 && (truncated & 1) != 0)) ? truncated + 1 : truncated;
+}
+
+inline auto putFloat(Writer &writer, const Spec &spec, double value) -> void {
+    const std::int8_t precision{spec.precision < 0 ? std::int8_t{6} : spec.precision};
+    char buf[32];
+
+    if (value != value) {
+        putString(writer, spec, "nan", 3);
+        return;
+    }
+
+    const bool negative{value < 0};
+    const double magnitude{negative ? -value : value};
+
+    if (!(magnitude * POW10[precision] < 1.8e19)) {
+        putFloatPrintf(writer, spec, precision, negative, magnitude);
+        return;
+    }
+
+    const std::uint64_t fixed{roundScaled(magnitude, POW10[precision])};
+    const std::uint64_t intPart{fixed / POW10[precision]};
+    const auto fracPart{static_cast<std::uint32_t>(fixed % POW10[precision])};
+
+    char *const end{buf + sizeof(buf)};
+    char *begin{end};
+
+    if (precision > 0) {
+        char *const fracBegin{toDecimal(fracPart, end)};
+        begin = end - precision;
+        std::memset(begin, '0', fracBegin - begin);
+        *--begin = '.';
+    }
+
+    begin = (intPart <= UINT32_MAX) ? toDecimal(static_cast<std::uint32_t>(intPart), begin) : toDecimal(intPart, begin);
+    putNumber(writer, spec, negative && fixed != 0, begin, end - begin);
+}
+
+template <typename T, typename = void>
+struct IsStringLike : std::false_type {};
+
+template <typename T>
+struct IsStringLike<T, std::void_t<decltype(std::declval<const T &>().data()),
+                                   decltype(std::declval<const T &>().length())>> : std::true_type {};
+
+template <typename T>
+auto putArg(Writer &writer, const Spec &spec, const void *arg) -> void {
+    const T &value{*static_cast<const T *>(arg)};
+
+    if constexpr (std::is_same_v<T, bool>) {
+        putString(writer, spec, value ? "true" : "false", value ? 4 : 5);
+    } else if constexpr (std::is_same_v<T, char>) {
+        putString(writer, spec, &value, 1);
+    } else if constexpr (std::is_integral_v<T>) {
+        putInteger(writer, spec, value);
+    } else if constexpr (std::is_enum_v<T>) {
+        putInteger(writer, spec, static_cast<std::underlying_type_t<T>>(value));
+    } else if constexpr (std::is_floating_point_v<T>) {
+        putFloat(writer, spec, value);
+    } else if constexpr (std::is_same_v<T, const char *> || std::is_same_v<T, char *>) {
+        const char *str{value != nullptr ? value : "(null)"};
+        putString(writer, spec, str, std::strlen(str));
+    } else if constexpr (std::is_array_v<T> && std::is_same_v<std::remove_cv_t<std::remove_extent_t<T>>, char>) {
+        /* String literals arrive as arrays */
+        const std::string_view str{value, std::extent_v<T>};
+        putString(writer, spec, value, minimum(str.find('\0'), str.size()));
+    } else if constexpr (std::is_pointer_v<T>) {
+        writer.put("0x", 2);
+        putInteger(writer, Spec{'x'}, reinterpret_cast<std::uintptr_t>(value));
+    } else if constexpr (IsStringLike<T>::value) {
+        putString(writer, spec, value.data(), value.length());
+    } else {
+        static_assert(!sizeof(T), "Type not supported by TextBuffer::format()");
+    }
+}
+
+template <typename FormatString, typename... Args>
+auto formatTo(Writer &writer, const Args &...args) -> void {
+    using Format = Compiled<FormatString>;
+    static_assert(Format::INFO.valid, "Malformed format string");
+    static_assert(Format::INFO.args == sizeof...(Args), "Format string placeholders don't match the argument count");
+
+    using PutFn = void (*)(Writer &, const Spec &, const void *);
+    const PutFn putFns[sizeof...(Args) + 1]{putArg<Args>..., nullptr};
+    const void *const argPtrs[sizeof...(Args) + 1]{static_cast<const void *>(&args)..., nullptr};
+    std::size_t argIdx{0};
+
+    for (const Segment &segment : Format::SEGMENTS) {
+        if (segment.isArg) {
+            putFns[argIdx](writer, segment.spec, argPtrs[argIdx]);
+            ++argIdx;
+        } else {
+            writer.put(Format::STR.data() + segment.begin, segment.length);
+        }
+    }
+}
+} // namespace Fmt
+
 template <std::size_t Size>
 class TextBuffer {
     std::array<char, Size> m_buf;
@@ -65,8 +467,115 @@ public:
         std::va_list args;
 
         va_start(args, format);
-        m_len = std::vsnprintf(m_buf.data(), Size, format, args);
+        const int len{std::vsnprintf(m_buf.data(), Size, format, args)};
         va_end(args);
+
+        /* vsnprintf reports the untruncated length */
+        m_len = (len < 0) ? 0 : minimum<std::size_t>(len, Size - 1);
+        m_buf[m_len] = '\0';
+    }
+
+    /* Type safe replacement for printf() with the format string given by ZZ_FMT.
+     * Returns false if the result had to be truncated. */
+    template <typename FormatString, typename... Args>
+    auto format(FormatString, const Args &...args) -> bool {
+        m_len = 0;
+        return append(FormatString{}, args...);
+    }
+
+    template <typename FormatString, typename... Args>
+    auto append(FormatString, const Args &...args) -> bool {
+        Fmt::Writer writer{m_buf.data(), Size - 1, m_len};
+        Fmt::formatTo<FormatString>(writer, args...);
+        m_len = writer.finish();
+
+        return !writer.overflowed();
+    }
+};
+
+/* Fixed-size histogram over power-of-two buckets: bucket 0 holds zero,
+ * bucket i holds values in [2^(i-1), 2^i), the last bucket everything above.
+ * Not synchronized, meant to be fed from a single context. */
+template <std::size_t Buckets>
+class Log2Histogram {
+    static_assert(Buckets >= 2 && Buckets <= 33, "Log2Histogram bucket count out of range");
+
+    std::array<std::uint32_t, Buckets> m_buckets{};
+    std::uint32_t m_count{0};
+    std::uint64_t m_sum{0};
+    std::uint32_t m_min{UINT32_MAX};
+    std::uint32_t m_max{0};
+
+public:
+    static constexpr std::size_t BUCKETS{Buckets};
+
+    static constexpr auto bucketOf(std::uint32_t value) -> std::size_t {
+        std::size_t idx{0};
+
+        while (value != 0) {
+            value >>= 1;
+            ++idx;
+        }
+
+        return minimum(idx, Buckets - 1);
+    }
+
+    /* Exclusive upper bound of a bucket, UINT32_MAX for the catch-all one */
+    static constexpr auto bucketLimit(std::size_t idx) -> std::uint32_t {
+        return (idx >= Buckets - 1 || idx >= 32) ? UINT32_MAX : (std::uint32_t{1} << idx);
+    }
+
+    auto record(std::uint32_t value) -> void {
+        ++m_buckets[bucketOf(value)];
+        ++m_count;
+        m_sum += value;
+        m_min = minimum(m_min, value);
+        m_max = (value > m_max) ? value : m_max;
+    }
+
+    auto reset() -> void {
+        *this = Log2Histogram{};
+    }
+
+    auto bucket(std::size_t idx) const -> std::uint32_t {
+        return m_buckets[idx];
+    }
+
+    auto count() const -> std::uint32_t {
+        return m_count;
+    }
+
+    auto sum() const -> std::uint64_t {
+        return m_sum;
+    }
+
+    auto min() const -> std::uint32_t {
+        return m_count ? m_min : 0;
+    }
+
+    auto max() const -> std::uint32_t {
+        return m_max;
+    }
+
+    auto avg() const -> std::uint32_t {
+        return m_count ? static_cast<std::uint32_t>(m_sum / m_count) : 0;
+    }
+
+    /* out is a std::string or any other std::basic_string<char> */
+    template <typename String>
+    auto appendJson(String &out) const -> void {
+        TextBuffer<96> buf;
+
+        buf.printf("{\"count\":%u,\"min\":%u,\"avg\":%u,\"max\":%u,\"buckets\":[",
+                   unsigned(count()), unsigned(min()), unsigned(avg()), unsigned(max()));
+        out.append(buf.data(), buf.length());
+
+        for (std::size_t idx = 0; idx < Buckets; ++idx) {
+            buf.printf(idx ? ",%u" : "%u", unsigned(m_buckets[idx]));
+            out.append(buf.data(), buf.length());
+        }
+
+        out.append("]}");
     }
 };
 
@@ -0,0 +1,340 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Zauberzeug GmbH
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef ZZ_WORKER_POOL_H
+#define ZZ_WORKER_POOL_H
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "esp_zeug/frtos-util.h"
+
+namespace ZZ::FrtosUtil {
+
+/* Completion handle of work submitted to a WorkerPool. Waiting on it doesn't
+ * just block, the waiting task executes pending work of the pool meanwhile. */
+class Future {
+public:
+    using HelpFn = bool (*)(void *);
+
+    Future() = default;
+
+    Future(const std::atomic<std::uint32_t> *generation, std::uint32_t expected, HelpFn help, void *pool)
+        : m_generation{generation}, m_expected{expected}, m_help{help}, m_pool{pool} {}
+
+    auto isDone() const -> bool {
+        return m_generation == nullptr || m_generation->load(std::memory_order_acquire) != m_expected;
+    }
+
+    auto wait() const -> void {
+        while (!isDone()) {
+            if (!m_help(m_pool)) {
+                vTaskDelay(1);
+            }
+        }
+    }
+
+private:
+    const std::atomic<std::uint32_t> *m_generation{nullptr};
+    std::uint32_t m_expected{0};
+    HelpFn m_help{nullptr};
+    void *m_pool{nullptr};
+};
+
+/* Spreads independent pieces of work over Workers statically allocated Tasks,
+ * alternating between the cores. Each worker owns a deque it pushes to and pops
+ * from at the bottom, idle workers steal from the top of the others' deques.
+ * When all Capacity work slots or the target deque are taken, submit() runs the
+ * work on the calling task instead. */
+template <std::size_t Workers, std::size_t Capacity = 32, std::size_t StackSize = 256 * 16>
+class WorkerPool {
+public:
+    using Callback = std::function<void()>;
+
+    struct WorkerStats {
+        std::uint32_t executed;
+        std::uint32_t stolen;
+    };
+
+    WorkerPool() : m_workers{makeWorkers(std::make_index_sequence<Workers>{})} {
+        for (std::size_t idx = 0; idx < Capacity; ++idx) {
+            m_slots[idx].nextFree = (idx + 1 < Capacity) ? &m_slots[idx + 1] : nullptr;
+        }
+        m_freeSlots = &m_slots[0];
+    }
+
+    WorkerPool(const WorkerPool &) = delete;
+    auto operator=(const WorkerPool &) -> WorkerPool & = delete;
+
+    auto run() -> void {
+        for (auto &worker : m_workers) {
+            worker.run();
+        }
+    }
+
+    auto submit(Callback work) -> Future {
+        WorkItem *item{allocSlot()};
+
+        if (item == nullptr) {
+            work();
+            return Future{};
+        }
+
+        item->work = std::move(work);
+        const std::uint32_t generation{item->generation.load(std::memory_order_relaxed)};
+        const std::size_t self{currentWorker()};
+        const std::size_t target{self < Workers ? self : m_nextTarget.fetch_add(1, std::memory_order_relaxed) % Workers};
+
+        if (!m_deques[target].pushBottom(item)) {
+            execute(*item);
+            return Future{};
+        }
+
+        if (self != target && m_workers[target].handle() != nullptr) {
+            xTaskNotifyGive(m_workers[target].handle());
+        }
+
+        return Future{&item->generation, generation, helpOne, this};
+    }
+
+    /* Calls fn(chunkBegin, chunkEnd) for consecutive chunks of at most grain
+     * elements covering [begin, end), and returns once all of them are done.
+     * The calling task takes part in the work. */
+    auto parallelFor(std::size_t begin, std::size_t end, std::size_t grain,
+                     const std::function<void(std::size_t, std::size_t)> &fn) -> void {
+        assert(grain > 0);
+
+        if (begin >= end) {
+            return;
+        }
+
+        const std::size_t chunks{(end - begin + grain - 1) / grain};
+        std::atomic<std::size_t> nextChunk{0};
+
+        auto runner{[&]() {
+            for (std::size_t chunk = nextChunk++; chunk < chunks; chunk = nextChunk++) {
+                const std::size_t chunkBegin{begin + chunk * grain};
+                fn(chunkBegin, Util::minimum(chunkBegin + grain, end));
+            }
+        }};
+
+        std::array<Future, Workers> futures{};
+        const std::size_t helpers{Util::minimum(chunks - 1, Workers)};
+
+        for (std::size_t idx = 0; idx < helpers; ++idx) {
+            futures[idx] = submit(runner);
+        }
+
+        runner();
+
+        for (std::size_t idx = 0; idx < helpers; ++idx) {
+            futures[idx].wait();
+        }
+    }
+
+    /* Runs one pending piece of work on the calling task, if there is any */
+    auto runOne() -> bool {
+        const std::size_t self{currentWorker()};
+        WorkItem *item{self < Workers ? m_deques[self].popBottom() : nullptr};
+
+        if (item == nullptr) {
+            item = steal(self);
+        }
+
+        if (item == nullptr) {
+            return false;
+        }
+
+        execute(*item);
+        return true;
+    }
+
+    auto workerStats(std::size_t worker) const -> WorkerStats {
+        return WorkerStats{m_stats[worker].executed.load(), m_stats[worker].stolen.load()};
+    }
+
+private:
+    static constexpr std::size_t DEQUE_SIZE{Capacity};
+    /* Upper bound for an idle worker to notice work it wasn't notified about */
+    static constexpr TickType_t IDLE_TIMEOUT_MS{10};
+
+    struct WorkItem {
+        Callback work;
+        /* Bumped on completion, which is what Futures are waiting for */
+        std::atomic<std::uint32_t> generation{0};
+        WorkItem *nextFree{nullptr};
+    };
+
+    class Deque {
+        portMUX_TYPE m_lock = portMUX_INITIALIZER_UNLOCKED;
+        std::array<WorkItem *, DEQUE_SIZE> m_items{};
+        std::uint32_t m_top{0};
+        std::uint32_t m_bottom{0};
+
+    public:
+        auto pushBottom(WorkItem *item) -> bool {
+            portENTER_CRITICAL(&m_lock);
+            const bool hasSpace{m_bottom - m_top < DEQUE_SIZE};
+
+            if (hasSpace) {
+                m_items[m_bottom++ % DEQUE_SIZE] = item;
+            }
+            portEXIT_CRITICAL(&m_lock);
+
+            return hasSpace;
+        }
+
+        auto popBottom() -> WorkItem * {
+            WorkItem *item{nullptr};
+
+            portENTER_CRITICAL(&m_lock);
+            if (m_bottom != m_top) {
+                item = m_items[--m_bottom % DEQUE_SIZE];
+            }
+            portEXIT_CRITICAL(&m_lock);
+
+            return item;
+        }
+
+        auto stealTop() -> WorkItem * {
+            WorkItem *item{nullptr};
+
+            portENTER_CRITICAL(&m_lock);
+            if (m_bottom != m_top) {
+                item = m_items[m_top++ % DEQUE_SIZE];
+            }
+            portEXIT_CRITICAL(&m_lock);
+
+            return item;
+        }
+
+        auto isEmpty() const -> bool {
+            return m_bottom == m_top;
+        }
+    };
+
+    struct AtomicStats {
+        std::atomic<std::uint32_t> executed{0};
+        std::atomic<std::uint32_t> stolen{0};
+    };
+
+    std::array<Task<StackSize>, Workers> m_workers;
+    std::array<Deque, Workers> m_deques;
+    std::array<AtomicStats, Workers> m_stats;
+    std::array<WorkItem, Capacity> m_slots;
+
+    portMUX_TYPE m_freeLock = portMUX_INITIALIZER_UNLOCKED;
+    WorkItem *m_freeSlots{nullptr};
+    std::atomic<std::size_t> m_nextTarget{0};
+
+    template <std::size_t... Idx>
+    auto makeWorkers(std::index_sequence<Idx...>) -> std::array<Task<StackSize>, Workers> {
+        return {Task<StackSize>{"zz-worker", coreFor(Idx), [this]() { workerLoop(Idx); }}...};
+    }
+
+    static constexpr auto coreFor(std::size_t worker) -> Core::Id {
+        return portNUM_PROCESSORS > 1 ? static_cast<Core::Id>(worker % 2) : Core::Any;
+    }
+
+    static auto helpOne(void *pool) -> bool {
+        return static_cast<WorkerPool *>(pool)->runOne();
+    }
+
+    /* Index of the worker the calling task is, Workers for any other task */
+    auto currentWorker() const -> std::size_t {
+        const TaskHandle_t current{xTaskGetCurrentTaskHandle()};
+
+        for (std::size_t idx = 0; idx < Workers; ++idx) {
+            if (m_workers[idx].handle() == current) {
+                return idx;
+            }
+        }
+
+        return Workers;
+    }
+
+    auto allocSlot() -> WorkItem * {
+        portENTER_CRITICAL(&m_freeLock);
+        WorkItem *item{m_freeSlots};
+
+        if (item != nullptr) {
+            m_freeSlots = item->nextFree;
+        }
+        portEXIT_CRITICAL(&m_freeLock);
+
+        return item;
+    }
+
+    auto execute(WorkItem &item) -> void {
+        item.work();
+        /* Release captured state before anyone learns about the completion */
+        item.work = nullptr;
+        item.generation.fetch_add(1, std::memory_order_release);
+
+        portENTER_CRITICAL(&m_freeLock);
+        item.nextFree = m_freeSlots;
+        m_freeSlots = &item;
+        portEXIT_CRITICAL(&m_freeLock);
+    }
+
+    auto steal(std::size_t self) -> WorkItem * {
+        for (std::size_t offset = 1; offset <= Workers; ++offset) {
+            const std::size_t victim{(self + offset) % Workers};
+
+            if (victim == self) {
+                continue;
+            }
+
+            WorkItem *item{m_deques[victim].stealTop()};
+
+            if (item != nullptr) {
+                if (self < Workers) {
+                    ++m_stats[self].stolen;
+                }
+                return item;
+            }
+        }
+
+        return nullptr;
+    }
+
+    auto workerLoop(std::size_t self) -> void {
+        WorkItem *item{m_deques[self].popBottom()};
+
+        if (item == nullptr) {
+            item = steal(self);
+        }
+
+        if (item == nullptr) {
+            ulTaskNotifyTake(pdTRUE, msToTicks(IDLE_TIMEOUT_MS));
+            return;
+        }
+
+        /* More queued up behind this one, get a neighbour to steal it */
+        if (!m_deques[self].isEmpty()) {
+            const TaskHandle_t neighbour{m_workers[(self + 1) % Workers].handle()};
+
+            if (neighbour != nullptr && Workers > 1) {
+                xTaskNotifyGive(neighbour);
+            }
+        }
+
+        execute(*item);
+        ++m_stats[self].executed;
+    }
+};
+
+} // namespace ZZ::FrtosUtil
+
+#endif // ZZ_WORKER_POOL_H
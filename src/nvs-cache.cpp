@@ -12,13 +12,15 @@
 #define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
 #include <esp_log.h>
 
+#include "esp_zeug/deferred-log.h"
+
 namespace ZZ {
 
 static const char *TAG{"esp_zeug/NvsCache"};
 const nvs_handle_t NvsCache::NULL_HANDLE{0};
 
-NvsCache::NvsCache(const std::string_view &nspace)
-    : m_handle{NULL_HANDLE}, m_nspace{nspace} {
+NvsCache::NvsCache(const std::string_view &nspace, Alloc::BlockPool *pool)
+    : m_handle{NULL_HANDLE}, m_nspace{nspace}, m_cacheMap{CacheMap::allocator_type{pool}} {
 }
 
 NvsCache::~NvsCache() {
@@ -94,7 +96,7 @@ auto NvsCache::getTyped(const char *key, ZZ::NvsType::Type type) -> const Value
     const CacheMap::const_iterator iter{m_cacheMap.find(key)};
 
     if (iter == m_cacheMap.cend()) {
-        ESP_LOGD(TAG, "miss: %s", key);
+        ZZ_DLOGD(TAG, "miss: %s", Util::TextBuffer<16>{key});
         /* Cache miss */
         Value val{};
         esp_err_t ec{queryInternal(m_handle, key, val, type)};
@@ -106,7 +108,7 @@ auto NvsCache::getTyped(const char *key, ZZ::NvsType::Type type) -> const Value
         auto insPair{m_cacheMap.emplace(key, std::move(val))};
         return insPair.first->second;
     } else {
-        ESP_LOGD(TAG, "hit: %s", key);
+        ZZ_DLOGD(TAG, "hit: %s", Util::TextBuffer<16>{key});
         return iter->second;
     }
 }